@@ -0,0 +1,82 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+thread_local bool realtimeThread{ false };
+thread_local int64 numRealtimeAllocations{ 0 };
+
+} // namespace
+
+AllocationCounter::ScopedRealtimeSection::ScopedRealtimeSection() noexcept
+    : wasRealtime{ realtimeThread }
+{
+    realtimeThread = true;
+}
+
+AllocationCounter::ScopedRealtimeSection::~ScopedRealtimeSection()
+{
+    realtimeThread = wasRealtime;
+}
+
+AllocationCounter::ScopedUncountedSection::ScopedUncountedSection() noexcept
+    : wasRealtime{ realtimeThread }
+{
+    realtimeThread = false;
+}
+
+AllocationCounter::ScopedUncountedSection::~ScopedUncountedSection()
+{
+    realtimeThread = wasRealtime;
+}
+
+int64 AllocationCounter::getNumRealtimeAllocations() noexcept
+{
+    return numRealtimeAllocations;
+}
+
+//==============================================================================
+
+#if JUCE_DEBUG
+
+void* operator new(std::size_t size)
+{
+    if (realtimeThread)
+        ++numRealtimeAllocations;
+
+    if (auto* ptr{ std::malloc(size == 0 ? 1 : size) })
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (realtimeThread && ptr != nullptr)
+        ++numRealtimeAllocations;
+
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    ::operator delete(ptr);
+}
+
+void operator delete(void* ptr, [[maybe_unused]] std::size_t size) noexcept
+{
+    ::operator delete(ptr);
+}
+
+void operator delete[](void* ptr, [[maybe_unused]] std::size_t size) noexcept
+{
+    ::operator delete(ptr);
+}
+
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+
+/**
+ * Counter of the heap allocations and frees made on the realtime threads.
+ *
+ * In debug builds the global operators new and delete are replaced to count
+ * the calls made by the threads within a ScopedRealtimeSection. Counts are
+ * kept per thread, so that plugin instances processed on different audio
+ * threads do not see each other's allocations. Memory obtained otherwise
+ * (malloc, mmap) is not counted. Release builds do not count anything.
+ */
+class AllocationCounter final
+{
+public:
+
+#if JUCE_DEBUG
+    constexpr static bool isEnabled = true;
+#else
+    constexpr static bool isEnabled = false;
+#endif
+
+    /**
+     * Mark the calling thread as realtime for the scope lifetime.
+     */
+    class ScopedRealtimeSection final
+    {
+    public:
+        ScopedRealtimeSection() noexcept;
+        ~ScopedRealtimeSection();
+
+        ScopedRealtimeSection(const ScopedRealtimeSection&) = delete;
+        ScopedRealtimeSection& operator=(const ScopedRealtimeSection&) = delete;
+
+    private:
+        bool wasRealtime;
+    };
+
+    /**
+     * Stop counting the calling thread allocations for the scope lifetime,
+     * e.g. while running the script on the audio thread, which allocates.
+     */
+    class ScopedUncountedSection final
+    {
+    public:
+        ScopedUncountedSection() noexcept;
+        ~ScopedUncountedSection();
+
+        ScopedUncountedSection(const ScopedUncountedSection&) = delete;
+        ScopedUncountedSection& operator=(const ScopedUncountedSection&) = delete;
+
+    private:
+        bool wasRealtime;
+    };
+
+    /// Number of allocations and frees made by the calling thread within the realtime sections.
+    static int64 getNumRealtimeAllocations() noexcept;
+};
@@ -0,0 +1,170 @@
+#include "ControllerMap.h"
+#include <bit>
+#include <cmath>
+
+ControllerMap::ControllerMap(tonewheel::Engine& eng, ParameterQueue& paramQueue)
+    : engine{ eng }
+    , parameterQueue{ paramQueue }
+{
+    reset();
+}
+
+void ControllerMap::addBinding(int controller, const ParameterBinding& binding)
+{
+    if (controller < 0 || controller >= NumControllers || binding.parameter == nullptr)
+        return;
+
+    scriptBindings.push_back({ controller, binding });
+    publishBindings();
+
+    // Initialise the parameter with the current controller value,
+    // through the queue since the audio thread may be writing it
+    const float value{ getValue(controller) };
+    binding.post(parameterQueue, controller == PitchBend ? 0.5f * (value + 1.0f) : value);
+}
+
+void ControllerMap::clearBindings()
+{
+    scriptBindings.clear();
+    bindings.publish(nullptr);
+
+    for (auto& b : bound)
+        b = false;
+}
+
+void ControllerMap::setForwarded(int controller, bool shouldForward)
+{
+    if (controller >= 0 && controller < NumControllers)
+        forwarding[(size_t)controller] = shouldForward ? Forwarding::Always : Forwarding::Never;
+}
+
+void ControllerMap::setTarget(int controller, float value)
+{
+    if (controller < 0 || controller >= NumControllers)
+        return;
+
+    targets[(size_t)controller].store(value, std::memory_order_relaxed);
+    changed[(size_t)controller / 64].fetch_or(uint64_t{ 1 } << (controller % 64), std::memory_order_release);
+}
+
+float ControllerMap::getValue(int controller) const
+{
+    if (controller >= 0 && controller < NumControllers)
+        return values[(size_t)controller].load(std::memory_order_relaxed);
+
+    return 0.0f;
+}
+
+void ControllerMap::reset()
+{
+    scriptBindings.clear();
+    bindings.reset();
+
+    for (size_t i = 0; i < NumControllers; ++i) {
+        targets[i] = 0.0f;
+        values[i] = 0.0f;
+        forwarding[i] = Forwarding::Unbound;
+        bound[i] = false;
+        isActive[i] = false;
+    }
+
+    for (auto& mask : changed)
+        mask = 0;
+
+    numActive = 0;
+    smoothingTime = DefaultSmoothingTime;
+}
+
+bool ControllerMap::process(const MidiMessage& msg)
+{
+    if (msg.isController()) {
+        const int cc{ msg.getControllerNumber() };
+
+        // Channel mode messages always go to the script
+        if (msg.isAllNotesOff() || msg.isAllSoundOff() || cc >= 120)
+            return false;
+
+        setTarget(cc, float(msg.getControllerValue()) * (1.0f / 127.0f));
+        return isConsumed(cc);
+    }
+
+    if (msg.isPitchWheel()) {
+        const float pitch{ float(msg.getPitchWheelValue() - 8192) * (1.0f / 8192.0f) };
+        setTarget(PitchBend, jlimit(-1.0f, 1.0f, pitch));
+        return isConsumed(PitchBend);
+    }
+
+    return false;
+}
+
+bool ControllerMap::isConsumed(int controller) const noexcept
+{
+    switch (forwarding[(size_t)controller].load(std::memory_order_relaxed)) {
+    case Forwarding::Always:
+        return false;
+    case Forwarding::Never:
+        return true;
+    default:
+        return bound[(size_t)controller].load(std::memory_order_relaxed);
+    }
+}
+
+void ControllerMap::advance(int numFrames, float sampleRate)
+{
+    const float tau{ smoothingTime.load(std::memory_order_relaxed) };
+    const float k{ tau > 0.0f ? 1.0f - std::exp(-float(numFrames) / (tau * sampleRate)) : 1.0f };
+
+    for (int word = 0; word < NumMaskWords; ++word) {
+        for (auto bits{ changed[(size_t)word].exchange(0, std::memory_order_acquire) }; bits != 0; bits &= bits - 1) {
+            const int controller{ word * 64 + std::countr_zero(bits) };
+
+            if (!isActive[(size_t)controller]) {
+                isActive[(size_t)controller] = true;
+                activeControllers[(size_t)numActive++] = controller;
+            }
+        }
+    }
+
+    const RealtimePublisher<Bindings>::ScopedAccess b{ bindings };
+    int n{ 0 };
+
+    for (int a = 0; a < numActive; ++a) {
+        const int i{ activeControllers[(size_t)a] };
+        const auto target{ targets[(size_t)i].load(std::memory_order_relaxed) };
+        auto value{ values[(size_t)i].load(std::memory_order_relaxed) };
+
+        if (value == target) {
+            isActive[(size_t)i] = false;
+            continue;
+        }
+
+        activeControllers[(size_t)n++] = i;
+
+        value += (target - value) * k;
+
+        if (std::abs(target - value) < 1.0e-4f)
+            value = target;
+
+        values[(size_t)i].store(value, std::memory_order_relaxed);
+
+        if (i < NumCCs)
+            engine.setCC(i, value);
+
+        if (b) {
+            // Bindings map the pitch-bend -1..1 range onto 0..1
+            const float x{ i == PitchBend ? 0.5f * (value + 1.0f) : value };
+
+            b->apply(i, parameterQueue, x);
+        }
+    }
+}
+
+void ControllerMap::publishBindings()
+{
+    auto newBindings{ Bindings::build(scriptBindings) };
+
+    for (int i = 0; i < NumControllers; ++i)
+        bound[(size_t)i] = newBindings->isBound(i);
+
+    bindings.publish(std::move(newBindings));
+}
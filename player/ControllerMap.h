@@ -0,0 +1,112 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "engine.h"
+#include "ParameterBinding.h"
+#include "ParameterQueue.h"
+#include "RealtimePublisher.h"
+#include <array>
+#include <atomic>
+#include <vector>
+
+/**
+ * Native MIDI CC and pitch-bend handling.
+ *
+ * Controller messages are handled on the audio thread: the values are
+ * smoothed per rendered chunk and written into the engine CC parameters,
+ * as well as into the audio parameters bound to the controllers.
+ * Only the controllers which are moving are smoothed.
+ * Messages are passed on to the script unless the controller is bound
+ * to an audio parameter, the script can override this per controller.
+ */
+class ControllerMap final
+{
+public:
+
+    constexpr static int NumCCs = 128;
+    constexpr static int PitchBend = NumCCs;    // Pitch-bend controller index
+    constexpr static int NumControllers = NumCCs + 1;
+
+    /// Default smoothing time constant, in seconds.
+    constexpr static float DefaultSmoothingTime = 0.01f;
+
+    ControllerMap(tonewheel::Engine& eng, ParameterQueue& paramQueue);
+
+    /**
+     * Bind a controller to an audio parameter.
+     * This must be called on the script thread.
+     */
+    void addBinding(int controller, const ParameterBinding& binding);
+
+    /// Remove all the bindings.
+    void clearBindings();
+
+    /// Always (or never) pass the controller messages on to the script, whether bound or not.
+    void setForwarded(int controller, bool shouldForward);
+
+    /// Set controller value (normalised, pitch-bend is -1..1). This is lock-free.
+    void setTarget(int controller, float value);
+
+    /// Current smoothed controller value.
+    float getValue(int controller) const;
+
+    void setSmoothingTime(float t) noexcept { smoothingTime = jmax(0.0f, t); }
+    float getSmoothingTime() const noexcept { return smoothingTime; }
+
+    /**
+     * Reset the controllers and drop the bindings.
+     *
+     * @note This must only be called when the audio thread is not running.
+     */
+    void reset();
+
+    // Audio thread interface
+
+    /**
+     * Handle a MIDI message.
+     *
+     * @return true if the message has been consumed.
+     */
+    bool process(const MidiMessage& msg);
+
+    /// Advance the smoothing by the given number of frames.
+    void advance(int numFrames, float sampleRate);
+
+private:
+
+    using Bindings = ParameterBindingTable<NumControllers>;
+
+    enum class Forwarding : int8_t
+    {
+        Unbound,    // Passed on to the script unless bound
+        Always,
+        Never
+    };
+
+    constexpr static int NumMaskWords = (NumControllers + 63) / 64;
+
+    void publishBindings();
+    bool isConsumed(int controller) const noexcept;
+
+    tonewheel::Engine& engine;
+    ParameterQueue& parameterQueue;
+
+    // Script thread only
+    std::vector<std::pair<int, ParameterBinding>> scriptBindings;
+
+    RealtimePublisher<Bindings> bindings;
+
+    std::array<std::atomic<float>, NumControllers> targets;
+    std::array<std::atomic<float>, NumControllers> values;
+    std::array<std::atomic<Forwarding>, NumControllers> forwarding;
+    std::array<std::atomic<bool>, NumControllers> bound;
+    std::atomic<float> smoothingTime{ DefaultSmoothingTime };
+
+    // Controllers whose target has been set since the last advance()
+    std::array<std::atomic<uint64_t>, NumMaskWords> changed;
+
+    // Audio thread only, controllers still moving towards their target
+    std::array<int, NumControllers> activeControllers{};
+    std::array<bool, NumControllers> isActive{};
+    int numActive{ 0 };
+};
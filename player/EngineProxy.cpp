@@ -3,7 +3,14 @@
 #include "audio_bus.h"
 #include "audio_parameter.h"
 #include "audio_effect.h"
+#include "AllocationCounter.h"
+#include "SlabPool.h"
+#include "quickjs.h"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <limits>
+#include <map>
 
 template<class C, class WrapperClass>
 class Wrapper : public script::ScriptClass
@@ -26,6 +33,33 @@ public:
         console = c;
     }
 
+    void setEngineProxy(EngineProxy* proxy)
+    {
+        engineProxy = proxy;
+    }
+
+    /**
+     * Change parameter value via the parameters queue,
+     * so that it gets applied by the audio thread.
+     */
+    static void postParameterValue(EngineProxy* proxy, Console* console, tonewheel::AudioParameter& param, float value,
+                                   double delay = 0.0, double ramp = 0.0, ParameterQueue::Ramp shape = ParameterQueue::Ramp::Linear)
+    {
+        if (proxy == nullptr) {
+            param.setValue(value);
+            return;
+        }
+
+        if (!proxy->getParameterQueue().post(&param, value, delay, ramp, shape) && console != nullptr)
+            console->postMessage("*** Parameter queue is full");
+    }
+
+    /// Parameter value including the changes not yet applied by the audio thread.
+    static float getQueuedParameterValue(EngineProxy* proxy, tonewheel::AudioParameter& param)
+    {
+        return proxy != nullptr ? proxy->getParameterQueue().getValue(&param) : param.getTargetValue();
+    }
+
     template<typename T>
     void addProperty(script::Local<script::Object>& obj,
                 const std::string& name,
@@ -56,7 +90,7 @@ public:
         assert(scriptEngine != nullptr);
     }
 
-    static script::Local<script::Value> createInstance(script::ScriptEngine* scriptEngine, C* obj, Console* console = nullptr)
+    static script::Local<script::Value> createInstance(script::ScriptEngine* scriptEngine, C* obj, Console* console = nullptr, EngineProxy* proxy = nullptr)
     {
         assert(scriptEngine != nullptr);
 
@@ -64,6 +98,7 @@ public:
         auto* wrapper{ scriptEngine->getNativeInstance<WrapperClass>(wrapperObj) };
         wrapper->setObject(obj);
         wrapper->setConsole(console);
+        wrapper->setEngineProxy(proxy);
         wrapper->exposeCustomProperties(wrapperObj);
 
         return wrapperObj;
@@ -74,6 +109,7 @@ public:
 protected:
     C* wrappedObject{ nullptr };
     Console* console{ nullptr };
+    EngineProxy* engineProxy{ nullptr };
 };
 
 //==============================================================================
@@ -139,13 +175,51 @@ public:
     float getValue() const
     {
         assert(wrappedObject != nullptr);
-        return wrappedObject->getTargetValue();
+        return getQueuedParameterValue(engineProxy, *wrappedObject);
     }
 
     void setValue(float x)
     {
         assert(wrappedObject != nullptr);
-        wrappedObject->setValue(x);
+        postParameterValue(engineProxy, console, *wrappedObject, x);
+    }
+
+    /**
+     * Change the value after a delay.
+     *   setValueAt(value, delaySeconds)
+     */
+    void setValueAt(float x, double delay)
+    {
+        assert(wrappedObject != nullptr);
+        assert(engineProxy != nullptr);
+        postParameterValue(engineProxy, console, *wrappedObject, x, delay);
+    }
+
+    /**
+     * Ramp the value.
+     *   rampTo(value, durationSeconds, shape = "linear" | "exp", delaySeconds = 0)
+     */
+    script::Local<script::Value> rampTo(const script::Arguments& args)
+    {
+        assert(wrappedObject != nullptr);
+        assert(engineProxy != nullptr);
+
+        if (args.size() < 2)
+            return {};
+
+        const float value{ args[0].asNumber().toFloat() };
+        const double duration{ args[1].asNumber().toDouble() };
+
+        auto shape{ ParameterQueue::Ramp::Linear };
+
+        if (args.size() > 2 && args[2].isString() && args[2].asString().toString() == "exp")
+            shape = ParameterQueue::Ramp::Exponential;
+
+        const double delay{ args.size() > 3 ? args[3].asNumber().toDouble() : 0.0 };
+
+        postParameterValue(engineProxy, console, *wrappedObject, value, delay, duration, shape);
+
+        return {};
     }
 
     static void registerWithScriptEngine(script::ScriptEngine* scriptEngine)
@@ -154,6 +228,8 @@ public:
             script::defineClass<AudioParameterWrapper>("AudioParameter")
                 .constructor()
                 .instanceProperty("value", &AudioParameterWrapper::getValue, &AudioParameterWrapper::setValue)
+                .instanceFunction("setValueAt", &AudioParameterWrapper::setValueAt)
+                .instanceFunction("rampTo", &AudioParameterWrapper::rampTo)
                 .build()
         };
 
@@ -183,8 +259,8 @@ public:
             auto& param{ params[i] };
 
             addProperty<float>(obj, param.getName(),
-                [&param]() { return param.getTargetValue(); },
-                [&param](float x) { param.setValue(x); }
+                [&param, proxy = engineProxy]() { return getQueuedParameterValue(proxy, param); },
+                [&param, proxy = engineProxy, con = console](float x) { postParameterValue(proxy, con, param, x); }
             );
         }
     }
@@ -207,7 +283,7 @@ public:
         for (int i = 0; i < paramsPool.getNumParameters(); ++i) {
             auto& param{ paramsPool[i] };
 
-            auto wrapperObj{ AudioParameterWrapper::createInstance(scriptEngine, &param) };
+            auto wrapperObj{ AudioParameterWrapper::createInstance(scriptEngine, &param, console, engineProxy) };
             paramsObj.set(param.getName(), wrapperObj);
         }
 
@@ -218,14 +294,14 @@ public:
     {
         assert(wrappedObject != nullptr);
         auto& param{ wrappedObject->getParameters().getParameterByName(name) };
-        param.setValue(value);
+        postParameterValue(engineProxy, console, param, value);
     }
 
     float getParameterValue(const std::string& name) const
     {
         assert(wrappedObject != nullptr);
         auto& param{ wrappedObject->getParameters().getParameterByName(name) };
-        return param.getTargetValue();
+        return getQueuedParameterValue(engineProxy, param);
     }
 
     static void registerWithScriptEngine(script::ScriptEngine* scriptEngine)
@@ -256,7 +332,7 @@ public:
     script::Local<script::Value> wrapEffect(tonewheel::AudioEffect* fx)
     {
         auto* scriptEngine{ getScriptEngine() };
-        return AudioEffectWrapper::createInstance(scriptEngine, fx);
+        return AudioEffectWrapper::createInstance(scriptEngine, fx, console, engineProxy);
     }
 
     script::Local<script::Value> addEffect(const std::string& tag)
@@ -266,7 +342,7 @@ public:
         auto& fxChain{ wrappedObject->getFxChain() };
 
         if (auto* fx{ fxChain.addEffectByTag(tag) })
-            return AudioEffectWrapper::createInstance(getScriptEngine(), fx);
+            return AudioEffectWrapper::createInstance(getScriptEngine(), fx, console, engineProxy);
 
         return {};
     }
@@ -282,34 +358,68 @@ public:
 
         for (int i = 0; i < fxChain.getNumEffects(); ++i) {
             auto* fx{ fxChain[i] };
-            effects.push_back(AudioEffectWrapper::createInstance(scriptEngine, fx));
+            effects.push_back(AudioEffectWrapper::createInstance(scriptEngine, fx, console, engineProxy));
         }
 
         return script::Array::newArray(effects);
     }
 
+    script::Local<script::Value> getParameters()
+    {
+        assert(wrappedObject != nullptr);
+
+        auto* scriptEngine{ getScriptEngine() };
+        auto& params{ wrappedObject->getParameters() };
+
+        auto paramsObj{ script::Object::newObject() };
+        paramsObj.set("gain", AudioParameterWrapper::createInstance(scriptEngine, &params[tonewheel::AudioBus::GAIN], console, engineProxy));
+        paramsObj.set("pan", AudioParameterWrapper::createInstance(scriptEngine, &params[tonewheel::AudioBus::PAN], console, engineProxy));
+
+        return paramsObj;
+    }
+
     float getGain() const
     {
         assert(wrappedObject != nullptr);
-        return wrappedObject->getParameters()[tonewheel::AudioBus::GAIN].getTargetValue();
+        return getQueuedParameterValue(engineProxy, wrappedObject->getParameters()[tonewheel::AudioBus::GAIN]);
     }
 
     void setGain(float gain)
     {
         assert(wrappedObject != nullptr);
-        wrappedObject->getParameters()[tonewheel::AudioBus::GAIN].setValue(gain);
+        postParameterValue(engineProxy, console, wrappedObject->getParameters()[tonewheel::AudioBus::GAIN], gain);
     }
 
     float getPan() const
     {
         assert(wrappedObject != nullptr);
-        return wrappedObject->getParameters()[tonewheel::AudioBus::PAN].getTargetValue();
+        return getQueuedParameterValue(engineProxy, wrappedObject->getParameters()[tonewheel::AudioBus::PAN]);
     }
 
     void setPan(float pan)
     {
         assert(wrappedObject != nullptr);
-        wrappedObject->getParameters()[tonewheel::AudioBus::PAN].setValue(pan);
+        postParameterValue(engineProxy, console, wrappedObject->getParameters()[tonewheel::AudioBus::PAN], pan);
+    }
+
+    void setIndex(int index) noexcept
+    {
+        busIndex = index;
+    }
+
+    /**
+     * Bus levels as Float32Array [peakL, peakR, rmsL, rmsR].
+     * The array reflects the last processed block, it must be
+     * read again on each poll rather than kept.
+     */
+    script::Local<script::Value> getMeter()
+    {
+        assert(engineProxy != nullptr);
+
+        if (busIndex < 0)
+            return {};
+
+        return engineProxy->getMeterView(busIndex);
     }
 
     static void registerWithScriptEngine(script::ScriptEngine* scriptEngine)
@@ -319,34 +429,119 @@ public:
                 .constructor()
                 .instanceFunction("addEffect", &AudioBusWrapper::addEffect)
                 .instanceProperty("effects",   &AudioBusWrapper::getEffects)
+                .instanceProperty("parameters", &AudioBusWrapper::getParameters)
                 .instanceProperty("gain",      &AudioBusWrapper::getGain, &AudioBusWrapper::setGain)
                 .instanceProperty("pan",       &AudioBusWrapper::getPan,  &AudioBusWrapper::setPan)
+                .instanceProperty("meter",     &AudioBusWrapper::getMeter)
                 .build()
         };
 
         scriptEngine->registerNativeClass(wrapperClassDef);
     }
+
+private:
+    int busIndex{ -1 };
 };
 
 //==============================================================================
 
+// Modulators are dropped by the audio thread when voices end, so they are
+// allocated from a lock-free pool rather than from the system heap.
+// The block accounts for the shared pointer control block as well.
+using ModulatorPool = SlabPool<sizeof(tonewheel::Voice::Modulator) + 64>;
+using ModulatorAllocator = SlabAllocator<tonewheel::Voice::Modulator, sizeof(tonewheel::Voice::Modulator) + 64>;
+
+static ModulatorPool& getModulatorPool()
+{
+    // Voices are process-wide and may outlive any plugin instance
+    static auto* pool{ new ModulatorPool() };
+    return *pool;
+}
+
+//==============================================================================
+
 class EngineWrapper : public Wrapper<tonewheel::Engine, EngineWrapper>
 {
 public:
+    constexpr static size_t MaxBatchSize = 64;
+
     EngineWrapper(const script::Local<script::Object>& self)
         : Wrapper<tonewheel::Engine, EngineWrapper>(self)
+        , triggerBatch(MaxBatchSize)
     {}
 
     int addSample(const std::string& filePath)
     {
         assert(wrappedObject != nullptr);
-        return wrappedObject->addSample(filePath);
+
+        double ratio{ 1.0 };
+        const auto path{ resolveSample(filePath, ratio) };
+
+        return path.empty() ? -1 : registerSample(wrappedObject->addSample(path), path, ratio);
     }
 
     int addSampleWithRange(const std::string& filePath, int startPos, int stopPos)
     {
         assert(wrappedObject != nullptr);
-        return wrappedObject->addSample(filePath, startPos, stopPos);
+
+        double ratio{ 1.0 };
+        const auto path{ resolveSample(filePath, ratio) };
+
+        if (path.empty())
+            return -1;
+
+        // Range is given in the source sample frames
+        startPos = roundToInt(startPos * ratio);
+        stopPos = roundToInt(stopPos * ratio);
+
+        return registerSample(wrappedObject->addSample(path, startPos, stopPos), path, ratio);
+    }
+
+    int addLoopedSample(const std::string& filePath, int loopBegin, int loopEnd, int xfade)
+    {
+        assert(wrappedObject != nullptr);
+        assert(engineProxy != nullptr);
+
+        auto& sampleCache{ engineProxy->getSampleCache() };
+        double ratio{ 1.0 };
+        const auto path{ sampleCache.resolveLoop(filePath, loopBegin, loopEnd, xfade, &ratio) };
+
+        if (path.empty()) {
+            if (console != nullptr)
+                console->postMessage("*** addLoopedSample: " + sampleCache.getLastError());
+
+            return -1;
+        }
+
+        return registerSample(wrappedObject->addSample(path), path, ratio);
+    }
+
+    bool getSampleRateConversion() const
+    {
+        assert(engineProxy != nullptr);
+        return engineProxy->getSampleCache().isResampling();
+    }
+
+    void setSampleRateConversion(bool shouldConvert)
+    {
+        assert(engineProxy != nullptr);
+        engineProxy->getSampleCache().setResampling(shouldConvert);
+    }
+
+    bool convertSample(const std::string& sourcePath, const std::string& targetPath)
+    {
+        assert(engineProxy != nullptr);
+
+        auto& sampleCache{ engineProxy->getSampleCache() };
+
+        if (!sampleCache.convert(File(String(sourcePath)), File(String(targetPath)))) {
+            if (console != nullptr)
+                console->postMessage("*** convertSample: " + sampleCache.getLastError());
+
+            return false;
+        }
+
+        return true;
     }
 
     double getBpm() const
@@ -391,7 +586,43 @@ public:
             return {};
 
         auto* scriptEngine{ getScriptEngine() };
-        return AudioBusWrapper::createInstance(scriptEngine, &audioBusPool[index]);
+        auto busObj{ AudioBusWrapper::createInstance(scriptEngine, &audioBusPool[index], console, engineProxy) };
+        scriptEngine->getNativeInstance<AudioBusWrapper>(busObj)->setIndex(index);
+
+        return busObj;
+    }
+
+    /**
+     * Declare the buses used by the patch, unused buses are not processed:
+     *   useBuses(count)
+     *   useBuses([index, ...])
+     */
+    script::Local<script::Value> useBuses(const script::Arguments& args)
+    {
+        assert(engineProxy != nullptr);
+
+        if (args.size() < 1)
+            return {};
+
+        uint32 mask{ 0 };
+
+        if (args[0].isNumber()) {
+            const int count{ jlimit(0, tonewheel::NUM_BUSES, args[0].asNumber().toInt32()) };
+            mask = count >= 32 ? 0xFFFFFFFF : ((1u << count) - 1);
+        } else if (args[0].isArray()) {
+            auto array{ args[0].asArray() };
+
+            for (size_t i = 0; i < array.size(); ++i) {
+                const int index{ array.get(i).asNumber().toInt32() };
+
+                if (index >= 0 && index < tonewheel::NUM_BUSES)
+                    mask |= 1u << index;
+            }
+        }
+
+        engineProxy->setUsedBusesMask(mask & EngineProxy::allBusesMask);
+
+        return {};
     }
 
     void addVoiceTriggerEffect(tonewheel::Engine::Trigger& trigger, const script::Local<script::Object>& desc)
@@ -432,13 +663,15 @@ public:
         if (expr.empty())
             return;
 
-        auto modulator{ std::make_shared<tonewheel::Voice::Modulator>() };
+        auto modulator{ std::allocate_shared<tonewheel::Voice::Modulator>(ModulatorAllocator(getModulatorPool())) };
 
         modulator->addConstant("sampleRate", wrappedObject->getSampleRate());
         modulator->addConstant("bpm", wrappedObject->getTransportInfo().bpm);
         modulator->addConstant("ppq", wrappedObject->getTransportInfo().ppqPosition);
 
-        std::map<std::string, float> dynVars;
+        // The variables map is reused, the modulator copies it. The modulator
+        // is destroyed on the script thread, see TriggerResources.
+        dynVars.clear();
 
         for (const auto& key : desc.getKeys()) {
             std::string name{ key.toString() };
@@ -451,8 +684,6 @@ public:
 
         // FX-chain parameters
         if (trigger.fxChain != nullptr) {
-
-
             for (int i = 0; i < trigger.fxChain->getNumEffects(); ++i) {
                 auto* effect{ trigger.fxChain->getEffectByIndex(i) };
                 const auto fxId{ effect->getId() };
@@ -465,8 +696,9 @@ public:
                         const auto& name{ param.getName() };
 
                         if (!name.empty()) {
-                            std::string sfxName{ fxId + "." + name };
-                            modulator->addDynamicVariable(sfxName, param.getTargetRef());
+                            // Reuse the name buffer capacity
+                            variableName.assign(fxId).append(".").append(name);
+                            modulator->addDynamicVariable(variableName, param.getTargetRef());
                         }
                     }
                 }
@@ -487,20 +719,8 @@ public:
         }
     }
 
-    script::Local<script::Value> trigger(const script::Arguments& args)
+    void parseTrigger(const script::Local<script::Object>& arg, tonewheel::Engine::Trigger& trigger)
     {
-        assert(wrappedObject != nullptr);
-
-        if (args.size() != 1)
-            return {};
-
-        if (!args[0].isObject())
-            return {};
-
-        auto arg{ args[0].asObject() };
-
-        tonewheel::Engine::Trigger trigger{};
-
         if (arg.has("sample"))
             trigger.sampleId = arg.get("sample").asNumber().toInt32();
         if (arg.has("bus"))
@@ -549,161 +769,973 @@ public:
             addVoiceTriggerModulation(trigger, obj);
         }
 
-        auto voiceId{ wrappedObject->triggerVoice(trigger) };
+        engineProxy->getTriggerResources().keep(trigger);
 
-        return script::Number::newNumber(voiceId);
+        // Positions are given in the source sample frames
+        if (const auto ratio{ getSampleRateRatio((int)trigger.sampleId) }; ratio != 1.0) {
+            trigger.offset = roundToInt(trigger.offset * ratio);
+            trigger.loopBegin = roundToInt(trigger.loopBegin * ratio);
+            trigger.loopEnd = roundToInt(trigger.loopEnd * ratio);
+            trigger.loopXfade = roundToInt(trigger.loopXfade * ratio);
+        }
     }
 
-    void release(int voiceId)
+    script::Local<script::Value> trigger(const script::Arguments& args)
     {
         assert(wrappedObject != nullptr);
-        wrappedObject->releaseVoice(voiceId);
-    }
+        assert(engineProxy != nullptr);
 
-    void releaseWithTime(int voiceId, float t)
-    {
-        assert(wrappedObject != nullptr);
-        wrappedObject->releaseVoice(voiceId, t);
-    }
+        if (args.size() != 1)
+            return {};
 
-    float getCC(int index)
-    {
-        return wrappedObject->getCC(index);
-    }
+        if (!args[0].isObject())
+            return {};
 
-    void setCC(int index, float value)
-    {
-        wrappedObject->setCC(index, value);
-    }
+        tonewheel::Engine::Trigger trigger{};
+        parseTrigger(args[0].asObject(), trigger);
 
-    static void registerWithScriptEngine(script::ScriptEngine* scriptEngine)
-    {
-        const static auto wrapperClassDef{
-            script::defineClass<EngineWrapper>("Engine")
-                .constructor()
-                .instanceFunction("addSample",          &EngineWrapper::addSample)
-                .instanceFunction("addSampleWithRange", &EngineWrapper::addSampleWithRange)
-                .instanceProperty("bpm",                &EngineWrapper::getBpm)
-                .instanceProperty("time",               &EngineWrapper::getTime)
-                .instanceProperty("musicTime",          &EngineWrapper::getMusicTime)
-                .instanceFunction("getBus",             &EngineWrapper::getBus)
-                .instanceProperty("bus",                &EngineWrapper::getBuses)
-                .instanceFunction("trigger",            &EngineWrapper::trigger)
-                .instanceFunction("release",            &EngineWrapper::release)
-                .instanceFunction("releaseWithTime",    &EngineWrapper::releaseWithTime)
-                .instanceFunction("getCC",              &EngineWrapper::getCC)
-                .instanceFunction("setCC",              &EngineWrapper::setCC)
-                .build()
-        };
+        if (!engineProxy->isBusUsed((int)trigger.busNumber)) {
+            if (console != nullptr)
+                console->postMessage("*** trigger: bus " + String((int)trigger.busNumber) + " is not used by the patch");
 
-        scriptEngine->registerNativeClass(wrapperClassDef);
-    }
-};
+            return script::Number::newNumber(VoiceBudget::NoVoice);
+        }
 
-//==============================================================================
+        const auto voiceId{ engineProxy->getVoiceBudget().postTrigger(trigger) };
 
-script::Local<script::Value> setTimeout(const script::Arguments& args)
-{
-    if (args.size() == 0)
-        return {};
+        if (voiceId == VoiceBudget::NoVoice && console != nullptr)
+            console->postMessage("*** Voice queue is full");
 
-    auto callback{ script::Global<script::Function>(args[0].asFunction()) };
-    int64_t delayMs{ 0 };
+        return script::Number::newNumber(voiceId);
+    }
 
-    if (args.size() > 1)
-        delayMs =args[1].asNumber().toInt64();
+    /**
+     * Trigger several voices at once.
+     *
+     * All the descriptors are validated first, then the voices are
+     * queued as a single batch, so that they start on the same sample frame.
+     *
+     * @return Int32Array of voice IDs.
+     */
+    script::Local<script::Value> triggerMany(const script::Arguments& args)
+    {
+        assert(wrappedObject != nullptr);
+        assert(engineProxy != nullptr);
 
-    auto* engine{ args.engine() };
+        if (args.size() != 1 || !args[0].isArray())
+            return {};
 
-    auto runner = [fun = std::move(callback), engine]() {
-        script::EngineScope scope(engine);
+        auto array{ args[0].asArray() };
+        const auto numTriggers{ array.size() };
 
-        try {
-            fun.get().call();
-        } catch (const script::Exception& e) {
-            DBG(e.what());
-            DBG(e.stacktrace());
+        if (numTriggers > MaxBatchSize) {
+            if (console != nullptr)
+                console->postMessage("*** triggerMany: too many voices in a batch");
+
+            return {};
         }
-    };
 
-    using RunnerType = decltype(runner);
+        const auto numBuses{ wrappedObject->getAudioBusPool().getNumBuses() };
+        const auto numSamples{ (int)tonewheel::GlobalEngine::getInstance()->getSamplePool().getNumSamples() };
 
-    auto&& queue{ engine->messageQueue() };
-    auto msg = queue->obtainInplaceMessage([](script::utils::InplaceMessage& msg) {
-        msg.getObject<RunnerType>()();
-    });
-    msg->inplaceObject<RunnerType>(std::move(runner));
-    queue->postMessage(msg, std::chrono::milliseconds(delayMs));
+        for (size_t i = 0; i < numTriggers; ++i) {
+            auto item{ array.get(i) };
 
-    return {};
-}
+            if (!item.isObject() || !item.asObject().has("sample") || !item.asObject().get("sample").isNumber()) {
+                if (console != nullptr)
+                    console->postMessage("*** triggerMany: invalid voice descriptor at index " + String((int)i));
 
-//==============================================================================
+                return {};
+            }
 
-EngineProxy::EngineProxy(tonewheel::Engine& eng, Console& con)
-    : juce::Thread("EngineProxy")
-    , engine{ eng }
-    , console{ con }
-    , scriptEngine{}
-{
-}
+            if (const auto sample{ item.asObject().get("sample").asNumber().toInt32() }; sample < 0 || sample >= numSamples) {
+                if (console != nullptr)
+                    console->postMessage("*** triggerMany: invalid sample at index " + String((int)i));
 
-EngineProxy::~EngineProxy()
-{
-    stop();
-}
+                return {};
+            }
 
-void EngineProxy::start(const String& code)
-{
-    scriptEngine.reset(new script::ScriptEngineImpl(), script::ScriptEngine::Deleter());
+            if (auto obj{ item.asObject() }; obj.has("bus")) {
+                const auto bus{ obj.get("bus").asNumber().toInt32() };
 
-    registerGlobals();
+                if (bus < 0 || bus >= numBuses || !engineProxy->isBusUsed(bus)) {
+                    if (console != nullptr)
+                        console->postMessage("*** triggerMany: invalid or unused bus at index " + String((int)i));
 
-    // Perform script evaluation in order to initialize the context
-    eval(code);
+                    return {};
+                }
+            }
+        }
 
-    startThread();
-}
+        for (size_t i = 0; i < numTriggers; ++i) {
+            triggerBatch[i] = {};
+            parseTrigger(array.get(i).asObject(), triggerBatch[i]);
+        }
 
-void EngineProxy::stop()
-{
-    if (scriptEngine == nullptr)
-        return;
+        auto& voiceBudget{ engineProxy->getVoiceBudget() };
 
-    signalThreadShouldExit();
-    scriptEngine->messageQueue()->shutdownNow(true);
-    waitForThreadToExit(-1);
-    scriptEngine.reset();
-}
+        // All or nothing, a partial batch is never queued
+        if (!voiceBudget.reserve((int)numTriggers)) {
+            for (size_t i = 0; i < numTriggers; ++i)
+                triggerBatch[i] = {};
 
-void EngineProxy::setContentFolder(const File& dir)
-{
-    contentFolder = dir;
-}
+            if (console != nullptr)
+                console->postMessage("*** triggerMany: not enough room for the batch in the voice queue");
 
-void EngineProxy::postMessage(std::function<void()> func)
-{
-    auto* engine{ scriptEngine.get() };
-    script::EngineScope scope(engine);
-    auto callback{ script::Global<script::Function>(script::Function::newFunction(std::move(func))) };
+            return {};
+        }
 
-    auto runner = [fun = std::move(callback), engine]() {
-        script::EngineScope scope(engine);
+        auto buffer{ script::ByteBuffer::newByteBuffer(numTriggers * sizeof(int32_t)) };
+        auto* voiceIds{ static_cast<int32_t*>(buffer.getRawBytes()) };
 
-        try {
-            fun.get().call();
-        } catch (const script::Exception& e) {
-            DBG(e.what());
-            DBG(e.stacktrace());
+        voiceBudget.beginBatch();
+
+        for (size_t i = 0; i < numTriggers; ++i) {
+            voiceIds[i] = voiceBudget.postTrigger(triggerBatch[i]);
+            jassert(voiceIds[i] != VoiceBudget::NoVoice);
         }
-    };
 
-    using RunnerType = decltype(runner);
+        voiceBudget.endBatch();
 
-    auto&& queue{ engine->messageQueue() };
-    auto msg = queue->obtainInplaceMessage([](script::utils::InplaceMessage& msg) {
-        msg.getObject<RunnerType>()();
-    });
+        for (size_t i = 0; i < numTriggers; ++i)
+            triggerBatch[i] = {};
+
+        auto int32Array{ getScriptEngine()->get("Int32Array") };
+        return script::Object::newObject(int32Array, buffer);
+    }
+
+    /**
+     * Release several voices at once, on the same sample frame.
+     * Voice IDs can be passed as an array or a typed array.
+     */
+    script::Local<script::Value> releaseMany(const script::Arguments& args)
+    {
+        assert(wrappedObject != nullptr);
+        assert(engineProxy != nullptr);
+
+        if (args.size() < 1)
+            return {};
+
+        const float releaseTime{ args.size() > 1 ? args[1].asNumber().toFloat() : -1.0f };
+
+        bool queued{ true };
+
+        const auto releaseVoice = [this, releaseTime, &queued](int voiceId) {
+            queued = engineProxy->getVoiceBudget().postRelease(voiceId, releaseTime) && queued;
+        };
+
+        if (args[0].isByteBuffer()) {
+            auto buffer{ args[0].asByteBuffer() };
+
+            if (buffer.getType() != script::ByteBuffer::Type::kInt32)
+                return {};
+
+            const auto* voiceIds{ static_cast<const int32_t*>(buffer.getRawBytes()) };
+            const auto numVoices{ buffer.byteLength() / sizeof(int32_t) };
+
+            engineProxy->getVoiceBudget().beginBatch();
+
+            for (size_t i = 0; i < numVoices; ++i)
+                releaseVoice(voiceIds[i]);
+
+            engineProxy->getVoiceBudget().endBatch();
+        } else if (args[0].isArray()) {
+            auto array{ args[0].asArray() };
+
+            engineProxy->getVoiceBudget().beginBatch();
+
+            for (size_t i = 0; i < array.size(); ++i)
+                releaseVoice(array.get(i).asNumber().toInt32());
+
+            engineProxy->getVoiceBudget().endBatch();
+        }
+
+        if (!queued && console != nullptr)
+            console->postMessage("*** releaseMany: voice queue is full");
+
+        return {};
+    }
+
+    void release(int voiceId)
+    {
+        assert(engineProxy != nullptr);
+        engineProxy->getVoiceBudget().postRelease(voiceId);
+    }
+
+    void releaseWithTime(int voiceId, float t)
+    {
+        assert(engineProxy != nullptr);
+        engineProxy->getVoiceBudget().postRelease(voiceId, jmax(0.0f, t));
+    }
+
+    int getNumVoices() const
+    {
+        assert(engineProxy != nullptr);
+        return engineProxy->getVoiceBudget().getNumVoices();
+    }
+
+    std::string getThreadStats() const
+    {
+        assert(engineProxy != nullptr);
+
+        String report{ "script: " + engineProxy->getThreadPolicy() + "; " + engineProxy->getThreadStats().toString() };
+
+        const auto& prefetcher{ engineProxy->getSamplePrefetcher() };
+
+        if (prefetcher.isEnabled())
+            report << "\nprefetch: " << prefetcher.getThreadPolicy() << "; " << prefetcher.getThreadStats().toString();
+
+        return report.toStdString();
+    }
+
+    /**
+     * Configure the script thread scheduling:
+     *   { realtime: false, priority: 10, avoidAudioCores: true }
+     */
+    script::Local<script::Value> setThreadPolicy(const script::Arguments& args)
+    {
+        assert(engineProxy != nullptr);
+
+        if (args.size() != 1 || !args[0].isObject())
+            return {};
+
+        auto obj{ args[0].asObject() };
+        ThreadConfig::Policy policy{};
+
+        if (obj.has("realtime"))
+            policy.realtime = obj.get("realtime").asBoolean().value();
+        if (obj.has("priority"))
+            policy.priority = jlimit(1, 99, obj.get("priority").asNumber().toInt32());
+        if (obj.has("avoidAudioCores"))
+            policy.avoidAudioCores = obj.get("avoidAudioCores").asBoolean().value();
+
+        engineProxy->setThreadPolicy(policy);
+
+        return {};
+    }
+
+    /**
+     * Configure the predictive sample prefetch:
+     *   { enabled: true, bytes: 1048576, keyRange: 2, velocityRange: 16 }
+     * or false to disable it.
+     */
+    script::Local<script::Value> setPrefetch(const script::Arguments& args)
+    {
+        assert(engineProxy != nullptr);
+
+        if (args.size() != 1)
+            return {};
+
+        auto& prefetcher{ engineProxy->getSamplePrefetcher() };
+        auto settings{ prefetcher.getSettings() };
+
+        if (args[0].isBoolean()) {
+            settings.enabled = args[0].asBoolean().value();
+        } else if (args[0].isObject()) {
+            auto obj{ args[0].asObject() };
+
+            settings.enabled = obj.has("enabled") ? obj.get("enabled").asBoolean().value() : true;
+
+            if (obj.has("bytes"))
+                settings.bytes = (int64)obj.get("bytes").asNumber().toDouble();
+            if (obj.has("keyRange"))
+                settings.keyRange = obj.get("keyRange").asNumber().toInt32();
+            if (obj.has("velocityRange"))
+                settings.velocityRange = obj.get("velocityRange").asNumber().toInt32();
+        }
+
+        prefetcher.setSettings(settings);
+
+        return {};
+    }
+
+    std::string getPrefetchStats() const
+    {
+        assert(engineProxy != nullptr);
+        return engineProxy->getSamplePrefetcher().getStats().toString().toStdString();
+    }
+
+    int getVoiceBudget() const
+    {
+        assert(engineProxy != nullptr);
+        return engineProxy->getVoiceBudget().getBudget();
+    }
+
+    /**
+     * Schedule an action to be executed on the audio thread.
+     *
+     * The time is either a PPQ position (a number or { ppq: x }),
+     * or the scheduler clock time ({ seconds: x }, see engine.clock).
+     * The action is one of
+     *   { trigger: {...} }
+     *   { release: handle, time: t }    - release the voice of a scheduled trigger
+     *   { releaseVoice: id, time: t }   - release the voice by its ID
+     *   { parameter: p, value: x }      - set audio parameter value
+     *
+     * @return Event handle or undefined if the event cannot be scheduled.
+     */
+    script::Local<script::Value> schedule(const script::Arguments& args)
+    {
+        assert(wrappedObject != nullptr);
+        assert(engineProxy != nullptr);
+
+        if (args.size() != 2 || !args[1].isObject())
+            return {};
+
+        auto& scheduler{ engineProxy->getScheduler() };
+        auto* event{ scheduler.obtainEvent() };
+
+        if (event == nullptr) {
+            if (console != nullptr)
+                console->postMessage("*** Scheduler is full");
+
+            return {};
+        }
+
+        bool validTime{ false };
+
+        if (args[0].isNumber()) {
+            event->timeBase = Scheduler::TimeBase::Ppq;
+            event->time = args[0].asNumber().toDouble();
+            validTime = true;
+        } else if (args[0].isObject()) {
+            auto timeObj{ args[0].asObject() };
+
+            if (timeObj.has("seconds") && timeObj.get("seconds").isNumber()) {
+                event->timeBase = Scheduler::TimeBase::Seconds;
+                event->time = timeObj.get("seconds").asNumber().toDouble();
+                validTime = true;
+            } else if (timeObj.has("ppq") && timeObj.get("ppq").isNumber()) {
+                event->timeBase = Scheduler::TimeBase::Ppq;
+                event->time = timeObj.get("ppq").asNumber().toDouble();
+                validTime = true;
+            }
+        }
+
+        if (!validTime || !std::isfinite(event->time)) {
+            if (console != nullptr)
+                console->postMessage("*** schedule: invalid time");
+
+            scheduler.discardEvent(event);
+            return {};
+        }
+
+        auto action{ args[1].asObject() };
+
+        if (action.has("trigger") && action.get("trigger").isObject()) {
+            event->action = Scheduler::Action::Trigger;
+            parseTrigger(action.get("trigger").asObject(), event->trigger);
+
+            if (!engineProxy->isBusUsed((int)event->trigger.busNumber)) {
+                if (console != nullptr)
+                    console->postMessage("*** schedule: bus " + String((int)event->trigger.busNumber) + " is not used by the patch");
+
+                scheduler.discardEvent(event);
+                return {};
+            }
+
+            engineProxy->getSamplePrefetcher().hint((int)event->trigger.sampleId);
+        } else if (action.has("release")) {
+            event->action = Scheduler::Action::Release;
+            event->target = action.get("release").asNumber().toInt32();
+        } else if (action.has("releaseVoice")) {
+            event->action = Scheduler::Action::ReleaseVoice;
+            event->target = action.get("releaseVoice").asNumber().toInt32();
+        } else if (action.has("parameter")) {
+            auto param{ action.get("parameter") };
+
+            if (!getScriptEngine()->isInstanceOf<AudioParameterWrapper>(param)) {
+                scheduler.discardEvent(event);
+                return {};
+            }
+
+            event->action = Scheduler::Action::SetParameter;
+            event->parameter = getScriptEngine()->getNativeInstance<AudioParameterWrapper>(param)->getWrappedObject();
+            event->value = action.has("value") ? action.get("value").asNumber().toFloat() : 0.0f;
+        } else {
+            scheduler.discardEvent(event);
+            return {};
+        }
+
+        if (action.has("time"))
+            event->releaseTime = action.get("time").asNumber().toFloat();
+
+        return script::Number::newNumber(scheduler.post(event));
+    }
+
+    /**
+     * Map key/velocity zones to voices triggered natively on the audio thread.
+     *
+     * Each zone is a voice descriptor (as for trigger(), without fx and
+     * modulation) with optional ranges:
+     *   key, velocity, channel - a number or a [low, high] range,
+     *   roundRobin             - round-robin index of the zone,
+     *   release                - release the voice on note-off (default true),
+     *   velocityCurve          - gain = gain * velocity ^ velocityCurve (default 1).
+     *
+     * Note-on/off messages matching the zones are not passed to onMidiMessage().
+     *
+     * @return Number of mapped zones.
+     */
+    int mapZones(const script::Arguments& args)
+    {
+        assert(wrappedObject != nullptr);
+        assert(engineProxy != nullptr);
+
+        if (args.size() != 1 || !args[0].isArray())
+            return 0;
+
+        auto array{ args[0].asArray() };
+
+        std::vector<ZoneMap::Zone> zones;
+        zones.reserve(array.size());
+
+        const auto parseRange = [](const script::Local<script::Object>& obj, const char* name, int& low, int& high) {
+            if (!obj.has(name))
+                return;
+
+            auto value{ obj.get(name) };
+
+            if (value.isArray() && value.asArray().size() == 2) {
+                low = value.asArray().get(0).asNumber().toInt32();
+                high = value.asArray().get(1).asNumber().toInt32();
+            } else if (value.isNumber()) {
+                low = high = value.asNumber().toInt32();
+            }
+        };
+
+        for (size_t i = 0; i < array.size(); ++i) {
+            auto item{ array.get(i) };
+
+            if (!item.isObject())
+                continue;
+
+            auto obj{ item.asObject() };
+
+            if (obj.has("fx") || obj.has("modulate")) {
+                if (console != nullptr)
+                    console->postMessage("*** mapZones: fx and modulation are not supported in zones");
+
+                return 0;
+            }
+
+            ZoneMap::Zone zone{};
+
+            tonewheel::Engine::Trigger trigger{};
+            parseTrigger(obj, trigger);
+
+            if (!engineProxy->isBusUsed((int)trigger.busNumber)) {
+                if (console != nullptr)
+                    console->postMessage("*** mapZones: bus " + String((int)trigger.busNumber) + " is not used by the patch");
+
+                return 0;
+            }
+
+            zone.setTemplate(trigger);
+
+            parseRange(obj, "key", zone.keyLow, zone.keyHigh);
+            parseRange(obj, "velocity", zone.velocityLow, zone.velocityHigh);
+            parseRange(obj, "channel", zone.channelLow, zone.channelHigh);
+
+            if (obj.has("roundRobin"))
+                zone.roundRobin = obj.get("roundRobin").asNumber().toInt32();
+            if (obj.has("release"))
+                zone.release = obj.get("release").asBoolean().value();
+            if (obj.has("velocityCurve"))
+                zone.velocityCurve = obj.get("velocityCurve").asNumber().toFloat();
+
+            zones.push_back(zone);
+        }
+
+        if (!engineProxy->getZoneMap().setZones(zones)) {
+            if (console != nullptr)
+                console->postMessage("*** mapZones: too many distinct zone combinations");
+
+            return 0;
+        }
+
+        engineProxy->getSamplePrefetcher().setZones(zones);
+
+        return (int)zones.size();
+    }
+
+    void clearZones()
+    {
+        assert(engineProxy != nullptr);
+        engineProxy->getZoneMap().setZones({});
+        engineProxy->getSamplePrefetcher().setZones({});
+    }
+
+    void cancelScheduled()
+    {
+        assert(engineProxy != nullptr);
+        engineProxy->getScheduler().cancelAll();
+    }
+
+    double getClock() const
+    {
+        assert(engineProxy != nullptr);
+        return engineProxy->getScheduler().getClock();
+    }
+
+    int getRealtimeBudget() const
+    {
+        assert(engineProxy != nullptr);
+        return engineProxy->getRealtimeBudget();
+    }
+
+    void setRealtimeBudget(int us)
+    {
+        assert(engineProxy != nullptr);
+        engineProxy->setRealtimeBudget(us);
+    }
+
+    float getCC(int index)
+    {
+        return wrappedObject->getCC(index);
+    }
+
+    void setCC(int index, float value)
+    {
+        assert(engineProxy != nullptr);
+
+        // CC values are smoothed and written into the engine by the audio thread
+        engineProxy->getControllerMap().setTarget(index, value);
+    }
+
+    /**
+     * Parse audio parameter binding:
+     *   (parameter, { min: 0, max: 1, curve: "linear" | "exp" })
+     */
+    bool parseBinding(const script::Local<script::Value>& param, const script::Local<script::Value>& options, ParameterBinding& binding)
+    {
+        auto* scriptEngine{ getScriptEngine() };
+
+        if (!scriptEngine->isInstanceOf<AudioParameterWrapper>(param)) {
+            if (console != nullptr)
+                console->postMessage("*** Expecting an audio parameter to bind to");
+
+            return false;
+        }
+
+        binding.parameter = scriptEngine->getNativeInstance<AudioParameterWrapper>(param)->getWrappedObject();
+
+        if (options.isObject()) {
+            auto obj{ options.asObject() };
+
+            if (obj.has("min"))
+                binding.min = obj.get("min").asNumber().toFloat();
+            if (obj.has("max"))
+                binding.max = obj.get("max").asNumber().toFloat();
+            if (obj.has("curve") && obj.get("curve").isString())
+                binding.curve = obj.get("curve").asString().toString() == "exp"
+                    ? ParameterBinding::Curve::Exponential
+                    : ParameterBinding::Curve::Linear;
+        }
+
+        return true;
+    }
+
+    script::Local<script::Value> mapCC(const script::Arguments& args)
+    {
+        assert(engineProxy != nullptr);
+
+        if (args.size() < 2 || !args[0].isNumber())
+            return {};
+
+        ParameterBinding binding{};
+
+        if (parseBinding(args[1], args.size() > 2 ? args[2] : script::Local<script::Value>(), binding))
+            engineProxy->getControllerMap().addBinding(args[0].asNumber().toInt32(), binding);
+
+        return {};
+    }
+
+    script::Local<script::Value> mapPitchBend(const script::Arguments& args)
+    {
+        assert(engineProxy != nullptr);
+
+        if (args.size() < 1)
+            return {};
+
+        ParameterBinding binding{};
+
+        if (parseBinding(args[0], args.size() > 1 ? args[1] : script::Local<script::Value>(), binding))
+            engineProxy->getControllerMap().addBinding(ControllerMap::PitchBend, binding);
+
+        return {};
+    }
+
+    void clearControllerMappings()
+    {
+        assert(engineProxy != nullptr);
+        engineProxy->getControllerMap().clearBindings();
+    }
+
+    /**
+     * Declare a host parameter:
+     *   declareParameter(index, name, { default: 0..1, label: "", bind: param, min, max, curve })
+     */
+    script::Local<script::Value> declareParameter(const script::Arguments& args)
+    {
+        assert(engineProxy != nullptr);
+
+        if (args.size() < 2 || !args[0].isNumber() || !args[1].isString())
+            return {};
+
+        const int index{ args[0].asNumber().toInt32() };
+        float defaultValue{ 0.0f };
+        String label{};
+
+        if (args.size() > 2 && args[2].isObject()) {
+            auto obj{ args[2].asObject() };
+
+            if (obj.has("default"))
+                defaultValue = obj.get("default").asNumber().toFloat();
+            if (obj.has("label") && obj.get("label").isString())
+                label = obj.get("label").asString().toString();
+        }
+
+        auto& hostParameters{ engineProxy->getHostParameters() };
+
+        if (!hostParameters.declare(index, args[1].asString().toString(), label, defaultValue)) {
+            if (console != nullptr)
+                console->postMessage("*** Host parameter index must be in 0.." + String(HostParameters::NumParameters - 1));
+
+            return {};
+        }
+
+        if (args.size() > 2 && args[2].isObject()) {
+            auto obj{ args[2].asObject() };
+
+            if (obj.has("bind")) {
+                ParameterBinding binding{};
+
+                if (parseBinding(obj.get("bind"), args[2], binding))
+                    hostParameters.addBinding(index, binding);
+            }
+        }
+
+        return script::Number::newNumber(index);
+    }
+
+    script::Local<script::Value> mapParameter(const script::Arguments& args)
+    {
+        assert(engineProxy != nullptr);
+
+        if (args.size() < 2 || !args[0].isNumber())
+            return {};
+
+        ParameterBinding binding{};
+
+        if (parseBinding(args[1], args.size() > 2 ? args[2] : script::Local<script::Value>(), binding))
+            engineProxy->getHostParameters().addBinding(args[0].asNumber().toInt32(), binding);
+
+        return {};
+    }
+
+    void clearParameterMappings()
+    {
+        assert(engineProxy != nullptr);
+        engineProxy->getHostParameters().clearBindings();
+    }
+
+    /// Engine stats as Float32Array [activeVoices, processLoad]
+    script::Local<script::Value> getStats()
+    {
+        assert(engineProxy != nullptr);
+        return engineProxy->getMeterView(-1);
+    }
+
+    float getParameter(int index)
+    {
+        assert(engineProxy != nullptr);
+        return engineProxy->getHostParameters().getValue(index);
+    }
+
+    void forwardCC(int cc, bool shouldForward)
+    {
+        assert(engineProxy != nullptr);
+
+        if (cc >= 0 && cc < ControllerMap::NumCCs)
+            engineProxy->getControllerMap().setForwarded(cc, shouldForward);
+    }
+
+    void forwardPitchBend(bool shouldForward)
+    {
+        assert(engineProxy != nullptr);
+        engineProxy->getControllerMap().setForwarded(ControllerMap::PitchBend, shouldForward);
+    }
+
+    float getPitchBend() const
+    {
+        assert(engineProxy != nullptr);
+        return engineProxy->getControllerMap().getValue(ControllerMap::PitchBend);
+    }
+
+    float getControllerSmoothing() const
+    {
+        assert(engineProxy != nullptr);
+        return engineProxy->getControllerMap().getSmoothingTime();
+    }
+
+    void setControllerSmoothing(float t)
+    {
+        assert(engineProxy != nullptr);
+        engineProxy->getControllerMap().setSmoothingTime(t);
+    }
+
+    static void registerWithScriptEngine(script::ScriptEngine* scriptEngine)
+    {
+        const static auto wrapperClassDef{
+            script::defineClass<EngineWrapper>("Engine")
+                .constructor()
+                .instanceFunction("addSample",          &EngineWrapper::addSample)
+                .instanceFunction("addSampleWithRange", &EngineWrapper::addSampleWithRange)
+                .instanceFunction("addLoopedSample",    &EngineWrapper::addLoopedSample)
+                .instanceProperty("sampleRateConversion", &EngineWrapper::getSampleRateConversion, &EngineWrapper::setSampleRateConversion)
+                .instanceFunction("convertSample",      &EngineWrapper::convertSample)
+                .instanceProperty("bpm",                &EngineWrapper::getBpm)
+                .instanceProperty("time",               &EngineWrapper::getTime)
+                .instanceProperty("musicTime",          &EngineWrapper::getMusicTime)
+                .instanceFunction("getBus",             &EngineWrapper::getBus)
+                .instanceProperty("bus",                &EngineWrapper::getBuses)
+                .instanceFunction("useBuses",           &EngineWrapper::useBuses)
+                .instanceFunction("trigger",            &EngineWrapper::trigger)
+                .instanceFunction("release",            &EngineWrapper::release)
+                .instanceFunction("triggerMany",        &EngineWrapper::triggerMany)
+                .instanceFunction("releaseMany",        &EngineWrapper::releaseMany)
+                .instanceFunction("releaseWithTime",    &EngineWrapper::releaseWithTime)
+                .instanceFunction("getCC",              &EngineWrapper::getCC)
+                .instanceFunction("setCC",              &EngineWrapper::setCC)
+                .instanceFunction("mapCC",              &EngineWrapper::mapCC)
+                .instanceFunction("mapPitchBend",       &EngineWrapper::mapPitchBend)
+                .instanceFunction("clearControllerMappings", &EngineWrapper::clearControllerMappings)
+                .instanceFunction("forwardCC",          &EngineWrapper::forwardCC)
+                .instanceFunction("forwardPitchBend",   &EngineWrapper::forwardPitchBend)
+                .instanceProperty("pitchBend",          &EngineWrapper::getPitchBend)
+                .instanceFunction("declareParameter",   &EngineWrapper::declareParameter)
+                .instanceFunction("mapParameter",       &EngineWrapper::mapParameter)
+                .instanceFunction("clearParameterMappings", &EngineWrapper::clearParameterMappings)
+                .instanceFunction("getParameter",       &EngineWrapper::getParameter)
+                .instanceProperty("controllerSmoothing", &EngineWrapper::getControllerSmoothing, &EngineWrapper::setControllerSmoothing)
+                .instanceFunction("schedule",           &EngineWrapper::schedule)
+                .instanceFunction("cancelScheduled",    &EngineWrapper::cancelScheduled)
+                .instanceFunction("mapZones",           &EngineWrapper::mapZones)
+                .instanceFunction("clearZones",         &EngineWrapper::clearZones)
+                .instanceProperty("clock",              &EngineWrapper::getClock)
+                .instanceProperty("stats",              &EngineWrapper::getStats)
+                .instanceProperty("numVoices",          &EngineWrapper::getNumVoices)
+                .instanceProperty("voiceBudget",        &EngineWrapper::getVoiceBudget)
+                .instanceFunction("setPrefetch",        &EngineWrapper::setPrefetch)
+                .instanceProperty("prefetchStats",      &EngineWrapper::getPrefetchStats)
+                .instanceProperty("threadStats",        &EngineWrapper::getThreadStats)
+                .instanceFunction("setThreadPolicy",    &EngineWrapper::setThreadPolicy)
+                .instanceProperty("realtimeBudget",     &EngineWrapper::getRealtimeBudget, &EngineWrapper::setRealtimeBudget)
+                .build()
+        };
+
+        scriptEngine->registerNativeClass(wrapperClassDef);
+    }
+
+private:
+
+    /**
+     * Ratio of the loaded to the source sample frames, when the sample
+     * has been converted to the engine sample rate (1 otherwise).
+     */
+    double getSampleRateRatio(int sampleId) const
+    {
+        if (sampleId < 0 || (size_t)sampleId >= sampleRateRatios.size())
+            return 1.0;
+
+        return sampleRateRatios[(size_t)sampleId];
+    }
+
+    /// Map a sample path to the file the engine can stream, empty on error.
+    std::string resolveSample(const std::string& filePath, double& ratio)
+    {
+        assert(engineProxy != nullptr);
+
+        auto& sampleCache{ engineProxy->getSampleCache() };
+        const auto path{ sampleCache.resolve(filePath, &ratio) };
+
+        if (path.empty() && console != nullptr)
+            console->postMessage("*** addSample: " + sampleCache.getLastError());
+
+        return path;
+    }
+
+    int registerSample(int sampleId, const std::string& path, double ratio)
+    {
+        assert(engineProxy != nullptr);
+
+        // Reported once, when reaching the limit
+        if (!engineProxy->getSamplePrefetcher().addSample(sampleId, File(String(path)))
+            && sampleId == SamplePrefetcher::MaxSamples && console != nullptr)
+            console->postMessage("*** Samples beyond " + String(SamplePrefetcher::MaxSamples) + " are not prefetched");
+
+        if (sampleId >= 0) {
+            if ((size_t)sampleId >= sampleRateRatios.size())
+                sampleRateRatios.resize((size_t)sampleId + 1, 1.0);
+
+            sampleRateRatios[(size_t)sampleId] = ratio;
+        }
+
+        return sampleId;
+    }
+
+    std::vector<tonewheel::Engine::Trigger> triggerBatch;
+    std::vector<double> sampleRateRatios;
+    std::string variableName;
+    std::map<std::string, float> dynVars;
+};
+
+//==============================================================================
+
+script::Local<script::Value> setTimeout(const script::Arguments& args, juce::SpinLock& scriptLock)
+{
+    if (args.size() == 0)
+        return {};
+
+    auto callback{ script::Global<script::Function>(args[0].asFunction()) };
+    int64_t delayMs{ 0 };
+
+    if (args.size() > 1)
+        delayMs =args[1].asNumber().toInt64();
+
+    auto* engine{ args.engine() };
+
+    auto runner = [fun = std::move(callback), engine, &scriptLock]() {
+        const juce::SpinLock::ScopedLockType lock(scriptLock);
+        script::EngineScope scope(engine);
+
+        try {
+            fun.get().call();
+        } catch (const script::Exception& e) {
+            DBG(e.what());
+            DBG(e.stacktrace());
+        }
+    };
+
+    using RunnerType = decltype(runner);
+
+    auto&& queue{ engine->messageQueue() };
+    auto msg = queue->obtainInplaceMessage([](script::utils::InplaceMessage& msg) {
+        msg.getObject<RunnerType>()();
+    });
+    msg->inplaceObject<RunnerType>(std::move(runner));
+    queue->postMessage(msg, std::chrono::milliseconds(delayMs));
+
+    return {};
+}
+
+//==============================================================================
+
+EngineProxy::EngineProxy(tonewheel::Engine& eng, Console& con)
+    : juce::Thread("EngineProxy")
+    , engine{ eng }
+    , console{ con }
+    , voiceBudget(eng)
+    , scheduler(voiceBudget, parameterQueue)
+    , zoneMap(voiceBudget)
+    , controllerMap(eng, parameterQueue)
+    , hostParameters(parameterQueue)
+    , scriptEngine{}
+{
+    voiceBudget.setPrefetcher(&samplePrefetcher);
+}
+
+EngineProxy::~EngineProxy()
+{
+    stop();
+}
+
+void EngineProxy::start(const String& code)
+{
+    scriptEngine.reset(new script::ScriptEngineImpl(), script::ScriptEngine::Deleter());
+
+    voiceBudget.reset();
+    scheduler.reset();
+    zoneMap.reset();
+    controllerMap.reset();
+    parameterQueue.reset();
+    hostParameters.reset();
+    meters.reset();
+    sampleCache.setResampling(false);
+    samplePrefetcher.setSettings({});
+    samplePrefetcher.reset();
+    triggerResources.clear();
+    setThreadPolicy({});
+    setUsedBusesMask(allBusesMask);
+
+    // At most one modulator per engine voice, plus the ones held by the pending triggers
+    const auto numVoices{ (int)tonewheel::GlobalEngine::getInstance()->getVoicePool().getNumVoices() };
+    getModulatorPool().reserve(numVoices + Scheduler::NumEvents + VoiceBudget::NumHandles);
+
+    registerGlobals();
+
+    // Perform script evaluation in order to initialize the context
+    eval(code);
+
+    installRealtimeHandler();
+
+    startThread();
+}
+
+void EngineProxy::stop()
+{
+    if (scriptEngine == nullptr)
+        return;
+
+    realtimeEnabled = false;
+
+    signalThreadShouldExit();
+    scriptEngine->messageQueue()->shutdownNow(true);
+    waitForThreadToExit(-1);
+
+    {
+        const juce::SpinLock::ScopedLockType lock(scriptLock);
+        script::EngineScope scope(scriptEngine.get());
+        realtimeHandler.reset();
+        meterViews.clear();
+        scriptMeters.reset();
+    }
+
+    jsRuntime = nullptr;
+    scriptEngine.reset();
+}
+
+void EngineProxy::setContentFolder(const File& dir)
+{
+    contentFolder = dir;
+}
+
+void EngineProxy::postMessage(std::function<void()> func)
+{
+    auto* engine{ scriptEngine.get() };
+    const juce::SpinLock::ScopedLockType lock(scriptLock);
+    script::EngineScope scope(engine);
+    auto callback{ script::Global<script::Function>(script::Function::newFunction(std::move(func))) };
+
+    auto runner = [fun = std::move(callback), engine, this]() {
+        const juce::SpinLock::ScopedLockType lock(scriptLock);
+        script::EngineScope scope(engine);
+
+        try {
+            fun.get().call();
+        } catch (const script::Exception& e) {
+            DBG(e.what());
+            DBG(e.stacktrace());
+        }
+    };
+
+    using RunnerType = decltype(runner);
+
+    auto&& queue{ engine->messageQueue() };
+    auto msg = queue->obtainInplaceMessage([](script::utils::InplaceMessage& msg) {
+        msg.getObject<RunnerType>()();
+    });
     msg->inplaceObject<RunnerType>(std::move(runner));
     auto id{ queue->postMessage(msg) };
     assert(id != 0);
@@ -721,77 +1753,165 @@ void EngineProxy::postMidiMessage(const MidiMessage& midiMessage)
 
 void EngineProxy::postMidiMessage(const tonewheel::MidiMessage& midiMessage, bool notify)
 {
-    midiBuffer.send(midiMessage);
+    if (midiBuffer.send(midiMessage))
+        ++midiSent;
 
     if (notify)
-      scriptEngine->messageQueue()->interrupt();
+        this->notify();
 }
 
 void EngineProxy::notify()
 {
+    // Only the first pending notification is timed
+    int64 expected{ 0 };
+    notifyTicks.compare_exchange_strong(expected, Time::getHighResolutionTicks());
+
     scriptEngine->messageQueue()->interrupt();
 }
 
 bool EngineProxy::sendMidiMessage(const MidiMessage& midiMessage)
 {
-    auto wait{ std::make_shared<juce::WaitableEvent>() };
-
-    postMessage([this, wait, msg = midiMessage] {
-        callOnMidiMessage(msg);
-        wait->signal();
-    });
-
-    return wait->wait(100);
+    return sendMidiMessage(tonewheel::MidiMessage(midiMessage.getRawData(), (size_t)midiMessage.getRawDataSize(), midiMessage.getTimeStamp()));
 }
 
 bool EngineProxy::sendMidiMessage(const tonewheel::MidiMessage& midiMessage)
 {
-    auto wait{ std::make_shared<juce::WaitableEvent>() };
+    // Neither allocates nor takes the script lock: the message goes through
+    // the MIDI queue and the script thread reports back once it has processed it.
+    if (!midiBuffer.send(midiMessage))
+        return false;
 
-    postMessage([this, wait, msg = midiMessage] {
-        callOnMidiMessage(msg);
-        wait->signal();
-    });
+    const auto sent{ ++midiSent };
+    notify();
 
-    return wait->wait(100);
+    const auto deadline{ Time::getMillisecondCounter() + 100 };
+
+    while (midiProcessed.load() < sent) {
+        const auto now{ Time::getMillisecondCounter() };
+
+        if (now >= deadline || !midiProcessedEvent.wait((int)(deadline - now)))
+            return false;
+    }
+
+    return true;
 }
 
 void EngineProxy::run()
 {
+    threadStats.reset();
+    applyThreadPolicy();
+
+    console.postMessage("Script thread: " + getThreadPolicy(), Console::Source::Engine);
+
     while (!threadShouldExit()) {
+        recordWakeup();
+
+        // The host audio thread may have moved since the policy was applied
+        if (threadPolicyChanged.exchange(false) || ThreadConfig::getAudioCoresMask() != appliedAudioCoresMask) {
+            const auto previous{ getThreadPolicy() };
+            applyThreadPolicy();
+
+            if (const auto current{ getThreadPolicy() }; current != previous)
+                console.postMessage("Script thread: " + current, Console::Source::Engine);
+        }
+
         // @todo handle message loop interruption here
         tonewheel::MidiMessage msg;
+        int numProcessed{ 0 };
 
         while (midiBuffer.receive(msg)) {
+            const juce::SpinLock::ScopedLockType lock(scriptLock);
             callOnMidiMessage(msg);
+            ++numProcessed;
+        }
+
+        if (numProcessed > 0) {
+            midiProcessed += numProcessed;
+            midiProcessedEvent.signal();
+        }
+
+        {
+            // Destroy the trigger objects of the voices which have ended
+            const juce::SpinLock::ScopedLockType lock(scriptLock);
+            triggerResources.collect();
         }
 
         scriptEngine->messageQueue()->loopQueue(script::utils::MessageQueue::LoopType::kLoopAndWait);
     }
 }
 
+String EngineProxy::getThreadPolicy() const
+{
+    const SpinLock::ScopedLockType lock(threadPolicyLock);
+    return appliedThreadPolicy;
+}
+
+void EngineProxy::setThreadPolicy(const ThreadConfig::Policy& policy)
+{
+    {
+        const SpinLock::ScopedLockType lock(threadPolicyLock);
+        threadPolicy = policy;
+    }
+
+    threadPolicyChanged = true;
+}
+
+void EngineProxy::applyThreadPolicy()
+{
+    ThreadConfig::Policy policy{};
+
+    {
+        const SpinLock::ScopedLockType lock(threadPolicyLock);
+        policy = threadPolicy;
+    }
+
+    appliedAudioCoresMask = ThreadConfig::getAudioCoresMask();
+    const auto applied{ ThreadConfig::applyToCurrentThread(policy) };
+
+    const SpinLock::ScopedLockType lock(threadPolicyLock);
+    appliedThreadPolicy = applied;
+}
+
+void EngineProxy::recordWakeup()
+{
+    if (const auto ticks{ notifyTicks.exchange(0) }; ticks != 0) {
+        const auto latency_ms{ 1000.0 * Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - ticks) };
+        threadStats.addWakeup(latency_ms, wakeupDeadline_ms);
+    }
+}
+
 void EngineProxy::registerGlobals()
 {
-    script::EngineScope scope(scriptEngine.get());
+    {
+        const juce::SpinLock::ScopedLockType lock(scriptLock);
+        script::EngineScope scope(scriptEngine.get());
+
+        scriptEngine->set(script::String::newString(u8"setTimeout"), script::Function::newFunction(
+            [this](const script::Arguments& args) { return setTimeout(args, scriptLock); }
+        ));
 
-    scriptEngine->set(script::String::newString(u8"setTimeout"), script::Function::newFunction(setTimeout));
+        jsRuntime = script::qjs_interop::currentRuntime();
+        JS_SetInterruptHandler(jsRuntime, &EngineProxy::interruptHandler, this);
 
-    ConsoleWrapper::registerWithScriptEngine(scriptEngine.get());
-    AudioParameterWrapper::registerWithScriptEngine(scriptEngine.get());
-    AudioEffectWrapper::registerWithScriptEngine(scriptEngine.get());
-    AudioBusWrapper::registerWithScriptEngine(scriptEngine.get());
-    EngineWrapper::registerWithScriptEngine(scriptEngine.get());
+        ConsoleWrapper::registerWithScriptEngine(scriptEngine.get());
+        AudioParameterWrapper::registerWithScriptEngine(scriptEngine.get());
+        AudioEffectWrapper::registerWithScriptEngine(scriptEngine.get());
+        AudioBusWrapper::registerWithScriptEngine(scriptEngine.get());
+        EngineWrapper::registerWithScriptEngine(scriptEngine.get());
 
-    scriptEngine->set(script::String::newString(u8"engine"), EngineWrapper::createInstance(scriptEngine.get(), &engine, &console));
-    scriptEngine->set(script::String::newString(u8"console"), ConsoleWrapper::createInstance(scriptEngine.get(), &console));
+        scriptEngine->set(script::String::newString(u8"engine"), EngineWrapper::createInstance(scriptEngine.get(), &engine, &console, this));
+        scriptEngine->set(script::String::newString(u8"console"), ConsoleWrapper::createInstance(scriptEngine.get(), &console));
 
-    scriptEngine->set(script::String::newString(u8"$dir"), script::String::newString(contentFolder.getFullPathName().toStdString()));
+        scriptEngine->set(script::String::newString(u8"$dir"), script::String::newString(contentFolder.getFullPathName().toStdString()));
+    }
 
+    // Queued runners take the script lock themselves
     scriptEngine->messageQueue()->loopQueue(script::utils::MessageQueue::LoopType::kLoopOnce);
 }
 
 void EngineProxy::eval(const String& code)
 {
+    const juce::SpinLock::ScopedLockType lock(scriptLock);
     script::EngineScope scope(scriptEngine.get());
 
     try {
@@ -803,6 +1923,133 @@ void EngineProxy::eval(const String& code)
     }
 }
 
+void EngineProxy::installRealtimeHandler()
+{
+    const juce::SpinLock::ScopedLockType lock(scriptLock);
+    script::EngineScope scope(scriptEngine.get());
+
+    script::Local<script::Value> f{ scriptEngine->get("onMidiMessageRealtime") };
+
+    if (f.isFunction()) {
+        realtimeHandler = script::Global<script::Function>(f.asFunction());
+        realtimeEnabled = true;
+    } else {
+        realtimeHandler.reset();
+        realtimeEnabled = false;
+    }
+}
+
+script::Local<script::Value> EngineProxy::getMeterView(int index)
+{
+    if (index < -1 || index >= Meters::NumBuses)
+        return {};
+
+    if (scriptMeters == nullptr) {
+        scriptMeters = std::make_shared<Meters::Snapshot>();
+        meterViews.resize(Meters::NumBuses + 1);
+    }
+
+    // All the views share the copy, refreshed on each access
+    meters.readSnapshot(*scriptMeters);
+
+    auto& view{ meterViews[(size_t)(index + 1)] };
+
+    if (view.isEmpty()) {
+        // The view keeps the copy memory alive
+        float* data{ index < 0 ? scriptMeters->stats.data() : scriptMeters->buses.data() + index * Meters::NumBusFields };
+        const size_t size{ sizeof(float) * (size_t)(index < 0 ? Meters::NumStatsFields : Meters::NumBusFields) };
+
+        auto bytes{ script::ByteBuffer::newByteBuffer(std::shared_ptr<void>(scriptMeters, data), size) };
+        auto float32Array{ scriptEngine->get("Float32Array") };
+        view = script::Global<script::Value>(script::Object::newObject(float32Array, bytes));
+    }
+
+    return view.get();
+}
+
+int EngineProxy::interruptHandler([[maybe_unused]] JSRuntime* rt, void* opaque)
+{
+    auto* self{ static_cast<EngineProxy*>(opaque) };
+
+    if (self->inRealtimeCall.load(std::memory_order_relaxed)
+        && Time::getHighResolutionTicks() > self->realtimeDeadline.load(std::memory_order_relaxed))
+        return 1;
+
+    return 0;
+}
+
+void EngineProxy::beginRealtimeBlock() noexcept
+{
+    realtimeUsedTicks = 0;
+    realtimeBudgetExceeded = false;
+}
+
+bool EngineProxy::processMidiRealtime(const uint8* data, int size)
+{
+    if (!realtimeEnabled.load(std::memory_order_acquire) || realtimeBudgetExceeded || size < 1)
+        return false;
+
+    const auto budgetTicks{ Time::secondsToHighResolutionTicks(realtimeBudget_us.load() * 1.0e-6) };
+
+    if (realtimeUsedTicks >= budgetTicks)
+        return false;
+
+    // Never block the audio thread: fall back to the script thread when busy
+    const juce::SpinLock::ScopedTryLockType lock(scriptLock);
+
+    if (!lock.isLocked())
+        return false;
+
+    script::EngineScope scope(scriptEngine.get());
+
+    const auto startTicks{ Time::getHighResolutionTicks() };
+    realtimeDeadline = startTicks + budgetTicks - realtimeUsedTicks;
+    inRealtimeCall = true;
+
+    // Prevent the garbage collector from kicking in on the audio thread
+    const auto gcThreshold{ JS_GetGCThreshold(jsRuntime) };
+    JS_SetGCThreshold(jsRuntime, std::numeric_limits<size_t>::max());
+
+    bool handled{ false };
+
+    // The script engine allocates, this is left out of the realtime allocations check
+    const AllocationCounter::ScopedUncountedSection uncountedSection{};
+
+    try {
+        auto result{ realtimeHandler.get().call({},
+            script::Number::newNumber(int(data[0])),
+            script::Number::newNumber(size > 1 ? int(data[1]) : 0),
+            script::Number::newNumber(size > 2 ? int(data[2]) : 0)
+        ) };
+
+        handled = result.isBoolean() && result.asBoolean().value();
+    } catch (const script::Exception& e) {
+        // The handler may have triggered voices before being interrupted
+        // or failing, passing the message on would trigger them twice.
+        handled = true;
+        console.postMessage(e.what(), Console::Source::Audio);
+    }
+
+    JS_SetGCThreshold(jsRuntime, gcThreshold);
+    inRealtimeCall = false;
+
+    realtimeUsedTicks += Time::getHighResolutionTicks() - startTicks;
+
+    if (realtimeUsedTicks >= budgetTicks) {
+        // Run out of time: the rest of the block goes to the script thread
+        realtimeBudgetExceeded = true;
+        console.postMessage("*** onMidiMessageRealtime exceeded its time budget", Console::Source::Audio);
+    }
+
+    return handled;
+}
+
+void EngineProxy::processAudioEvents()
+{
+    voiceBudget.processCommands();
+    engine.processAudioEvents();
+}
+
 void EngineProxy::callOnMidiMessage(const MidiMessage& msg)
 {
     script::EngineScope scope(scriptEngine.get());
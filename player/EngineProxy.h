@@ -3,10 +3,25 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "ScriptX/ScriptX.h"
 #include "PluginConsole.h"
+#include "VoiceBudget.h"
+#include "Scheduler.h"
+#include "ZoneMap.h"
+#include "ControllerMap.h"
+#include "ParameterQueue.h"
+#include "HostParameters.h"
+#include "Meters.h"
+#include "SampleCache.h"
+#include "SamplePrefetcher.h"
+#include "ThreadConfig.h"
+#include "TriggerResources.h"
 #include "engine/engine.h"
 #include "engine/midi.h"
 #include "engine/core/ring_buffer.h"
+#include <atomic>
 #include <functional>
+#include <vector>
+
+struct JSRuntime;
 
 class EngineProxy final : public juce::Thread
 {
@@ -39,6 +54,8 @@ public:
 
     /**
      * Send MIDI message to be processed immediately.
+     * This neither allocates nor takes the script lock, so it can be
+     * called on the audio thread when rendering offline.
      *
      * @note This method blocks until the message is processed.
      *
@@ -48,6 +65,91 @@ public:
 
     bool sendMidiMessage(const tonewheel::MidiMessage& midiMessage);
 
+    VoiceBudget& getVoiceBudget() noexcept { return voiceBudget; }
+    const VoiceBudget& getVoiceBudget() const noexcept { return voiceBudget; }
+    Scheduler& getScheduler() noexcept { return scheduler; }
+    ZoneMap& getZoneMap() noexcept { return zoneMap; }
+    ControllerMap& getControllerMap() noexcept { return controllerMap; }
+    ParameterQueue& getParameterQueue() noexcept { return parameterQueue; }
+    HostParameters& getHostParameters() noexcept { return hostParameters; }
+    Meters& getMeters() noexcept { return meters; }
+    SampleCache& getSampleCache() noexcept { return sampleCache; }
+    SamplePrefetcher& getSamplePrefetcher() noexcept { return samplePrefetcher; }
+    TriggerResources& getTriggerResources() noexcept { return triggerResources; }
+
+    /**
+     * Float32Array view of the meters, as of this call.
+     *
+     * This is not zero-copy: each call copies the whole published snapshot
+     * (all the buses and the stats) into a buffer owned by the script, under
+     * the snapshot version check. The views over that buffer are created once
+     * and then reused, so the call does not allocate, but every view shows the
+     * values of the most recent call, whichever bus it was made for.
+     *
+     * @param index Bus number, or -1 for the engine stats.
+     *
+     * @note This must be called within the script engine scope.
+     */
+    script::Local<script::Value> getMeterView(int index);
+
+    /**
+     * Reset the realtime script handler budget.
+     * This is called by the audio thread on each processing block.
+     */
+    void beginRealtimeBlock() noexcept;
+
+    /**
+     * Call the onMidiMessageRealtime() script handler synchronously
+     * on the audio thread.
+     *
+     * The handler is called only if the script thread is not busy and
+     * the per-block time budget has not been exhausted. The handler is
+     * interrupted when running out of the budget.
+     *
+     * @return true if the message has been handled (including when the
+     *         handler has been interrupted or has thrown), false if it
+     *         has to be posted to the script thread.
+     */
+    bool processMidiRealtime(const uint8* data, int size);
+
+    /**
+     * Process the engine audio events.
+     *
+     * This is called by the audio thread instead of calling the engine
+     * directly. The voice triggers and releases queued by the script are
+     * passed to the engine first.
+     */
+    void processAudioEvents();
+
+    /// Mask of the engine buses used by the patch, all by default.
+    uint32 getUsedBusesMask() const noexcept { return usedBusesMask.load(std::memory_order_relaxed); }
+
+    void setUsedBusesMask(uint32 mask) noexcept
+    {
+        usedBusesMask = mask;
+        voiceBudget.setBusesMask(mask);
+    }
+
+    bool isBusUsed(int bus) const noexcept
+    {
+        return bus >= 0 && bus < tonewheel::NUM_BUSES && (getUsedBusesMask() & (1u << bus)) != 0;
+    }
+
+    constexpr static uint32 allBusesMask = tonewheel::NUM_BUSES >= 32 ? 0xFFFFFFFF : ((1u << tonewheel::NUM_BUSES) - 1);
+
+    /// Script thread wake-up statistics.
+    const ThreadConfig::Stats& getThreadStats() const noexcept { return threadStats; }
+
+    /// Scheduling policy actually applied to the script thread.
+    String getThreadPolicy() const;
+
+    /// Change the script thread scheduling policy, applied on its next wake-up.
+    void setThreadPolicy(const ThreadConfig::Policy& policy);
+
+    /// Realtime handler time budget per block, in microseconds.
+    int getRealtimeBudget() const noexcept { return realtimeBudget_us; }
+    void setRealtimeBudget(int us) noexcept { realtimeBudget_us = jmax(0, us); }
+
     // juce::String
     void run() override;
 
@@ -57,14 +159,65 @@ private:
 
     void eval(const String& code);
 
+    void installRealtimeHandler();
+
+    static int interruptHandler(JSRuntime* rt, void* opaque);
+
+    // Script thread must wake up within this time after being notified
+    constexpr static double wakeupDeadline_ms = 5.0;
+
+    void applyThreadPolicy();
+    void recordWakeup();
+
     void callOnMidiMessage(const MidiMessage& midiMessage);
     void callOnMidiMessage(const tonewheel::MidiMessage& midiMessage);
 
     File contentFolder{};
 
     tonewheel::core::RingBuffer<tonewheel::MidiMessage, 1024> midiBuffer;
+    std::atomic<int64> midiSent{ 0 };
+    std::atomic<int64> midiProcessed{ 0 };
+    juce::WaitableEvent midiProcessedEvent;
 
     tonewheel::Engine& engine;
     Console& console;
+    VoiceBudget voiceBudget;
+    ParameterQueue parameterQueue;
+    Scheduler scheduler;
+    ZoneMap zoneMap;
+    ControllerMap controllerMap;
+    HostParameters hostParameters;
+    Meters meters;
+    SampleCache sampleCache;
+    SamplePrefetcher samplePrefetcher;
+    TriggerResources triggerResources;
     std::shared_ptr<script::ScriptEngine> scriptEngine{ nullptr };
+
+    // Meters copy for the script and its views, script thread only
+    std::shared_ptr<Meters::Snapshot> scriptMeters;
+    std::vector<script::Global<script::Value>> meterViews;
+
+    // Serialises the script engine access between the script thread,
+    // the message thread and the audio thread (realtime handler).
+    juce::SpinLock scriptLock;
+
+    JSRuntime* jsRuntime{ nullptr };
+    script::Global<script::Function> realtimeHandler{};
+    std::atomic<bool> realtimeEnabled{ false };
+    std::atomic<int> realtimeBudget_us{ 200 };
+    std::atomic<bool> inRealtimeCall{ false };
+    std::atomic<int64> realtimeDeadline{ 0 };
+    int64 realtimeUsedTicks{ 0 };
+
+    ThreadConfig::Policy threadPolicy{};
+    std::atomic<bool> threadPolicyChanged{ false };
+    ThreadConfig::Stats threadStats{};
+    uint64 appliedAudioCoresMask{ 0 };
+    String appliedThreadPolicy{};
+    mutable SpinLock threadPolicyLock;
+    std::atomic<int64> notifyTicks{ 0 };
+
+    std::atomic<uint32> usedBusesMask{ allBusesMask };
+
+    bool realtimeBudgetExceeded{ false };
 };
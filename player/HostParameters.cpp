@@ -0,0 +1,200 @@
+#include "HostParameters.h"
+
+HostParameters::Parameter::Parameter(int idx)
+    : index{ idx }
+{
+    resetDeclaration();
+}
+
+void HostParameters::Parameter::setDeclaration(const String& n, const String& l, float defValue)
+{
+    {
+        const SpinLock::ScopedLockType lock(nameLock);
+        name = n;
+        label = l;
+    }
+
+    defaultValue = jlimit(0.0f, 1.0f, defValue);
+    declared = true;
+
+    if (!hasHostValue())
+        value = defaultValue.load();
+}
+
+void HostParameters::Parameter::resetDeclaration()
+{
+    {
+        const SpinLock::ScopedLockType lock(nameLock);
+        name = "Parameter " + String(index + 1);
+        label = {};
+    }
+
+    declared = false;
+}
+
+void HostParameters::Parameter::restoreValue(float newValue)
+{
+    value = jlimit(0.0f, 1.0f, newValue);
+    hostValue = true;
+}
+
+float HostParameters::Parameter::getValue() const
+{
+    return value.load(std::memory_order_relaxed);
+}
+
+void HostParameters::Parameter::setValue(float newValue)
+{
+    value.store(newValue, std::memory_order_relaxed);
+    hostValue.store(true, std::memory_order_relaxed);
+}
+
+float HostParameters::Parameter::getDefaultValue() const
+{
+    return defaultValue.load(std::memory_order_relaxed);
+}
+
+String HostParameters::Parameter::getName(int maximumStringLength) const
+{
+    const SpinLock::ScopedLockType lock(nameLock);
+    return name.substring(0, maximumStringLength);
+}
+
+String HostParameters::Parameter::getLabel() const
+{
+    const SpinLock::ScopedLockType lock(nameLock);
+    return label;
+}
+
+float HostParameters::Parameter::getValueForText(const String& text) const
+{
+    return jlimit(0.0f, 1.0f, text.getFloatValue());
+}
+
+//==============================================================================
+
+HostParameters::HostParameters(ParameterQueue& paramQueue)
+    : parameterQueue{ paramQueue }
+{
+    appliedValues.fill(-1.0f);
+}
+
+HostParameters::~HostParameters()
+{
+    cancelPendingUpdate();
+}
+
+void HostParameters::addTo(AudioProcessor& proc)
+{
+    jassert(processor == nullptr);
+    processor = &proc;
+
+    for (int i = 0; i < NumParameters; ++i) {
+        auto* param{ new Parameter(i) };
+        parameters[(size_t)i] = param;
+        proc.addParameter(param);
+    }
+}
+
+HostParameters::Parameter* HostParameters::getParameter(int index) const noexcept
+{
+    if (index >= 0 && index < NumParameters)
+        return parameters[(size_t)index];
+
+    return nullptr;
+}
+
+bool HostParameters::declare(int index, const String& name, const String& label, float defaultValue)
+{
+    auto* param{ getParameter(index) };
+
+    if (param == nullptr)
+        return false;
+
+    param->setDeclaration(name, label, defaultValue);
+
+    // Names are updated on the host side asynchronously
+    triggerAsyncUpdate();
+
+    return true;
+}
+
+void HostParameters::addBinding(int index, const ParameterBinding& binding)
+{
+    auto* param{ getParameter(index) };
+
+    if (param == nullptr || binding.parameter == nullptr)
+        return;
+
+    scriptBindings.push_back({ index, binding });
+    publishBindings();
+
+    // Initialise the audio parameter with the current value
+    binding.post(parameterQueue, param->getValue());
+}
+
+void HostParameters::clearBindings()
+{
+    scriptBindings.clear();
+    bindings.publish(nullptr);
+}
+
+float HostParameters::getValue(int index) const
+{
+    if (auto* param{ getParameter(index) })
+        return param->getValue();
+
+    return 0.0f;
+}
+
+void HostParameters::reset()
+{
+    scriptBindings.clear();
+    bindings.reset();
+
+    for (auto* param : parameters) {
+        if (param != nullptr)
+            param->resetDeclaration();
+    }
+
+    appliedValues.fill(-1.0f);
+
+    triggerAsyncUpdate();
+}
+
+void HostParameters::process()
+{
+    const RealtimePublisher<Bindings>::ScopedAccess b{ bindings };
+
+    // Newly published bindings get all the current values
+    const bool force{ forceUpdate.exchange(false) };
+
+    for (int i = 0; i < NumParameters; ++i) {
+        auto* param{ parameters[(size_t)i] };
+
+        if (param == nullptr)
+            continue;
+
+        const float value{ param->getValue() };
+
+        if (value == appliedValues[(size_t)i] && !force)
+            continue;
+
+        appliedValues[(size_t)i] = value;
+
+        if (b)
+            b->apply(i, parameterQueue, value);
+    }
+}
+
+void HostParameters::publishBindings()
+{
+    bindings.publish(Bindings::build(scriptBindings));
+    forceUpdate = true;
+}
+
+void HostParameters::handleAsyncUpdate()
+{
+    if (processor != nullptr)
+        processor->updateHostDisplay();
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "ParameterBinding.h"
+#include "RealtimePublisher.h"
+#include <array>
+#include <atomic>
+#include <vector>
+
+/**
+ * Bank of host-automatable parameters.
+ *
+ * The processor exposes a fixed number of parameters to the host. The patch
+ * script declares (names) them and binds them to audio parameters. Bindings
+ * are applied on the audio thread whenever the host changes a value, without
+ * involving the script.
+ */
+class HostParameters final : private AsyncUpdater
+{
+public:
+
+    constexpr static int NumParameters = 32;
+
+    /**
+     * Single host parameter, normalised 0..1.
+     */
+    class Parameter final : public AudioProcessorParameter
+    {
+    public:
+        explicit Parameter(int idx);
+
+        int getIndex() const noexcept { return index; }
+
+        void setDeclaration(const String& name, const String& label, float defaultValue);
+        void resetDeclaration();
+
+        bool isDeclared() const noexcept { return declared.load(std::memory_order_relaxed); }
+
+        /// Whether the value has been set by the host or restored from the state.
+        bool hasHostValue() const noexcept { return hostValue.load(std::memory_order_relaxed); }
+
+        void restoreValue(float newValue);
+
+        // juce::AudioProcessorParameter
+        float getValue() const override;
+        void setValue(float newValue) override;
+        float getDefaultValue() const override;
+        String getName(int maximumStringLength) const override;
+        String getLabel() const override;
+        float getValueForText(const String& text) const override;
+
+    private:
+        const int index;
+
+        std::atomic<float> value{ 0.0f };
+        std::atomic<float> defaultValue{ 0.0f };
+        std::atomic<bool> declared{ false };
+        std::atomic<bool> hostValue{ false };
+
+        mutable SpinLock nameLock;
+        String name;
+        String label;
+    };
+
+    HostParameters(ParameterQueue& paramQueue);
+    ~HostParameters() override;
+
+    /**
+     * Create the parameters and add them to the processor.
+     * The processor takes the parameters ownership.
+     */
+    void addTo(AudioProcessor& processor);
+
+    Parameter* getParameter(int index) const noexcept;
+
+    /**
+     * Declare a parameter.
+     * This must be called on the script thread.
+     *
+     * The parameter gets its default value unless the value
+     * has already been set by the host.
+     */
+    bool declare(int index, const String& name, const String& label, float defaultValue);
+
+    /**
+     * Bind a parameter to an audio parameter.
+     * This must be called on the script thread.
+     */
+    void addBinding(int index, const ParameterBinding& binding);
+
+    /// Remove all the bindings.
+    void clearBindings();
+
+    /// Parameter value, normalised 0..1.
+    float getValue(int index) const;
+
+    /**
+     * Drop the declarations and the bindings.
+     * The values are kept since they belong to the host.
+     *
+     * @note This must only be called when the audio thread is not running.
+     */
+    void reset();
+
+    // Audio thread interface
+
+    /// Apply the changed parameter values to the bindings.
+    void process();
+
+private:
+
+    using Bindings = ParameterBindingTable<NumParameters>;
+
+    void publishBindings();
+
+    // juce::AsyncUpdater
+    void handleAsyncUpdate() override;
+
+    ParameterQueue& parameterQueue;
+    AudioProcessor* processor{ nullptr };
+    std::array<Parameter*, NumParameters> parameters{};
+
+    // Script thread only
+    std::vector<std::pair<int, ParameterBinding>> scriptBindings;
+
+    RealtimePublisher<Bindings> bindings;
+    std::atomic<bool> forceUpdate{ false };
+
+    // Audio thread only
+    std::array<float, NumParameters> appliedValues;
+};
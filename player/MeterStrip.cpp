@@ -0,0 +1,108 @@
+#include "MeterStrip.h"
+
+MeterStrip::MeterStrip(Meters& m)
+    : meters{ m }
+{
+    setOpaque(true);
+    startTimerHz(refreshRateHz);
+}
+
+MeterStrip::~MeterStrip()
+{
+    stopTimer();
+}
+
+void MeterStrip::paint(Graphics& g)
+{
+    g.fillAll(Colours::black);
+
+    const auto bounds{ getLocalBounds().reduced(2).toFloat() };
+    const float busWidth{ bounds.getWidth() / float(Meters::NumBuses) };
+    const float clipHeight{ 4.0f };
+    const float labelHeight{ 12.0f };
+    const float meterHeight{ bounds.getHeight() - clipHeight - labelHeight - 2.0f };
+
+    g.setFont(10.0f);
+
+    for (int bus = 0; bus < Meters::NumBuses; ++bus) {
+        const auto& level{ levels[(size_t)bus] };
+        const float x{ bounds.getX() + float(bus) * busWidth };
+        const float barWidth{ jmax(1.0f, (busWidth - 4.0f) * 0.5f) };
+
+        g.setColour(level.clip ? Colours::red : Colours::darkgrey);
+        g.fillRect(x + 1.0f, bounds.getY(), busWidth - 2.0f, clipHeight);
+
+        const float meterTop{ bounds.getY() + clipHeight + 1.0f };
+
+        for (size_t ch = 0; ch < 2; ++ch) {
+            const float barX{ x + 1.0f + float(ch) * (barWidth + 1.0f) };
+
+            g.setColour(Colour(0xff202020));
+            g.fillRect(barX, meterTop, barWidth, meterHeight);
+
+            const float rmsHeight{ meterHeight * toProportion(level.rms[ch]) };
+            g.setColour(Colours::limegreen);
+            g.fillRect(barX, meterTop + meterHeight - rmsHeight, barWidth, rmsHeight);
+
+            const float peakY{ meterTop + meterHeight * (1.0f - toProportion(level.peak[ch])) };
+            g.setColour(level.peak[ch] > 0.0f ? Colours::orange : Colours::yellow);
+            g.fillRect(barX, jmin(peakY, meterTop + meterHeight - 1.0f), barWidth, 1.0f);
+        }
+
+        g.setColour(Colours::lightgrey);
+        g.drawText(String(bus + 1), Rectangle<float>(x, meterTop + meterHeight, busWidth, labelHeight),
+                   Justification::centred, false);
+    }
+}
+
+void MeterStrip::mouseDown([[maybe_unused]] const MouseEvent& event)
+{
+    for (auto& level : levels)
+        level.clip = false;
+
+    repaint();
+}
+
+float MeterStrip::toProportion(float decibels) noexcept
+{
+    return jlimit(0.0f, 1.0f, (decibels - minDecibels) / -minDecibels);
+}
+
+void MeterStrip::timerCallback()
+{
+    bool changed{ false };
+    std::array<float, Meters::NumBusFields> values{};
+
+    for (int bus = 0; bus < Meters::NumBuses; ++bus) {
+        meters.takeHeldLevels(bus, values);
+
+        auto& level{ levels[(size_t)bus] };
+
+        for (size_t ch = 0; ch < 2; ++ch) {
+            const float rms{ Decibels::gainToDecibels(values[Meters::RmsL + ch], minDecibels) };
+            const float peak{ Decibels::gainToDecibels(values[Meters::PeakL + ch], minDecibels) };
+
+            // Only redraw for visible changes
+            if (std::abs(rms - level.rms[ch]) > 0.1f) {
+                level.rms[ch] = rms;
+                changed = true;
+            }
+
+            const float decayedPeak{ jmax(minDecibels, level.peak[ch] - peakDecayDecibels) };
+            const float newPeak{ jmax(peak, decayedPeak) };
+
+            if (std::abs(newPeak - level.peak[ch]) > 0.1f) {
+                level.peak[ch] = newPeak;
+                changed = true;
+            }
+        }
+
+        if (!level.clip && jmax(values[Meters::TruePeakL], values[Meters::TruePeakR]) > 1.0f) {
+            level.clip = true;
+            changed = true;
+        }
+    }
+
+    if (changed)
+        repaint();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "Meters.h"
+#include <array>
+
+/**
+ * Strip of stereo level meters, one per audio bus.
+ *
+ * Shows RMS bars with decaying peak markers. A clip indicator lights up
+ * when the true-peak goes above 0 dBFS and stays on until clicked.
+ * The strip repaints only when the displayed levels change.
+ */
+class MeterStrip final : public Component,
+                         private Timer
+{
+public:
+
+    explicit MeterStrip(Meters& m);
+    ~MeterStrip() override;
+
+    void paint(Graphics& g) override;
+    void mouseDown(const MouseEvent& event) override;
+
+private:
+
+    constexpr static int refreshRateHz = 30;
+    constexpr static float minDecibels = -60.0f;
+    constexpr static float peakDecayDecibels = 0.5f;   // Per refresh
+
+    struct Level
+    {
+        std::array<float, 2> rms{ minDecibels, minDecibels };
+        std::array<float, 2> peak{ minDecibels, minDecibels };
+        bool clip{ false };
+    };
+
+    static float toProportion(float decibels) noexcept;
+
+    void timerCallback() override;
+
+    Meters& meters;
+    std::array<Level, Meters::NumBuses> levels{};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MeterStrip)
+};
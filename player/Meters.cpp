@@ -0,0 +1,197 @@
+#include "Meters.h"
+#include <cmath>
+
+Meters::Meters()
+{
+    reset();
+}
+
+void Meters::readSnapshot(Snapshot& snapshot) const noexcept
+{
+    for (;;) {
+        const auto& shared{ snapshots[(size_t)published.load(std::memory_order_acquire)] };
+        const auto version{ shared.version.load(std::memory_order_acquire) };
+
+        // Being overwritten, the audio thread has moved on meanwhile
+        if ((version & 1) != 0)
+            continue;
+
+        for (size_t i = 0; i < snapshot.buses.size(); ++i)
+            snapshot.buses[i] = shared.buses[i].load(std::memory_order_relaxed);
+
+        for (size_t i = 0; i < snapshot.stats.size(); ++i)
+            snapshot.stats[i] = shared.stats[i].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (shared.version.load(std::memory_order_relaxed) == version)
+            return;
+    }
+}
+
+float Meters::getBusValue(int bus, BusField field) const noexcept
+{
+    if (bus < 0 || bus >= NumBuses)
+        return 0.0f;
+
+    // A single value cannot be torn, no need for the version check
+    const auto& shared{ snapshots[(size_t)published.load(std::memory_order_acquire)] };
+    return shared.buses[(size_t)(bus * NumBusFields + field)].load(std::memory_order_relaxed);
+}
+
+void Meters::takeHeldLevels(int bus, std::array<float, NumBusFields>& levels) noexcept
+{
+    if (bus < 0 || bus >= NumBuses)
+        return;
+
+    for (int i = 0; i < NumBusFields; ++i) {
+        auto& value{ held[(size_t)(bus * NumBusFields + i)] };
+
+        if (i == RmsL || i == RmsR)
+            levels[(size_t)i] = value.load(std::memory_order_relaxed);
+        else
+            levels[(size_t)i] = value.exchange(0.0f, std::memory_order_relaxed);
+    }
+}
+
+void Meters::reset()
+{
+    for (auto& snapshot : snapshots) {
+        for (auto& value : snapshot.buses)
+            value = 0.0f;
+
+        for (auto& value : snapshot.stats)
+            value = 0.0f;
+
+        snapshot.version = 0;
+    }
+
+    for (auto& value : held)
+        value = 0.0f;
+
+    accumulators.fill({ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f });
+    published = 0;
+}
+
+void Meters::measureBus(int bus, const float* left, const float* right, int numFrames) noexcept
+{
+    if (bus < 0 || bus >= NumBuses)
+        return;
+
+    numFrames = jmin(numFrames, (int)scratch.size());
+
+    if (numFrames <= 0)
+        return;
+
+    auto& acc{ accumulators[(size_t)bus] };
+
+    const auto rangeL{ FloatVectorOperations::findMinAndMax(left, numFrames) };
+    const auto rangeR{ FloatVectorOperations::findMinAndMax(right, numFrames) };
+    const float peakL{ jmax(-rangeL.getStart(), rangeL.getEnd()) };
+    const float peakR{ jmax(-rangeR.getStart(), rangeR.getEnd()) };
+    acc.peakL = jmax(acc.peakL, peakL);
+    acc.peakR = jmax(acc.peakR, peakR);
+
+    acc.sumSquaresL += sumOfSquares(left, numFrames);
+    acc.sumSquaresR += sumOfSquares(right, numFrames);
+
+    // Silent chunks cannot have inter-sample peaks
+    if (peakL > 0.0f)
+        acc.truePeakL = jmax(acc.truePeakL, peakL, interpolatedPeak(left, scratch.data(), numFrames));
+
+    if (peakR > 0.0f)
+        acc.truePeakR = jmax(acc.truePeakR, peakR, interpolatedPeak(right, scratch.data(), numFrames));
+}
+
+void Meters::endBlock(int numFrames, float activeVoices, float processLoad) noexcept
+{
+    if (numFrames <= 0)
+        return;
+
+    // Write into the snapshot not currently published
+    const int index{ 1 - published.load(std::memory_order_relaxed) };
+    auto& snapshot{ snapshots[(size_t)index] };
+    const float norm{ 1.0f / float(numFrames) };
+
+    // Odd version while writing, readers retry their copy
+    const auto version{ snapshot.version.load(std::memory_order_relaxed) };
+    snapshot.version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (int bus = 0; bus < NumBuses; ++bus) {
+        auto& acc{ accumulators[(size_t)bus] };
+        auto* shared{ snapshot.buses.data() + bus * NumBusFields };
+
+        float values[NumBusFields];
+        values[PeakL] = acc.peakL;
+        values[PeakR] = acc.peakR;
+        values[RmsL] = std::sqrt(acc.sumSquaresL * norm);
+        values[RmsR] = std::sqrt(acc.sumSquaresR * norm);
+        values[TruePeakL] = acc.truePeakL;
+        values[TruePeakR] = acc.truePeakR;
+
+        for (int i = 0; i < NumBusFields; ++i)
+            shared[i].store(values[i], std::memory_order_relaxed);
+
+        // Hold the peaks until taken by the reader
+        auto* h{ held.data() + bus * NumBusFields };
+
+        for (int i = 0; i < NumBusFields; ++i) {
+            if (i == RmsL || i == RmsR)
+                h[i].store(values[i], std::memory_order_relaxed);
+            else if (values[i] > h[i].load(std::memory_order_relaxed))
+                h[i].store(values[i], std::memory_order_relaxed);
+        }
+
+        acc = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    }
+
+    snapshot.stats[ActiveVoices].store(activeVoices, std::memory_order_relaxed);
+    snapshot.stats[ProcessLoad].store(processLoad, std::memory_order_relaxed);
+
+    snapshot.version.store(version + 2, std::memory_order_release);
+    published.store(index, std::memory_order_release);
+}
+
+float Meters::sumOfSquares(const float* data, int numFrames) noexcept
+{
+    // Independent partial sums let the compiler vectorise the loop
+    constexpr int numLanes{ 8 };
+    float sums[numLanes]{};
+
+    int i{ 0 };
+
+    for (; i + numLanes <= numFrames; i += numLanes) {
+        for (int j = 0; j < numLanes; ++j)
+            sums[j] += data[i + j] * data[i + j];
+    }
+
+    for (; i < numFrames; ++i)
+        sums[0] += data[i] * data[i];
+
+    float sum{ 0.0f };
+
+    for (int j = 0; j < numLanes; ++j)
+        sum += sums[j];
+
+    return sum;
+}
+
+float Meters::interpolatedPeak(const float* data, float* scratch, int numFrames) noexcept
+{
+    // Mid-points of 4-point cubic interpolation:
+    // y[i] = (9 * (x[i + 1] + x[i + 2]) - x[i] - x[i + 3]) / 16
+    const int n{ numFrames - 3 };
+
+    if (n <= 0)
+        return 0.0f;
+
+    FloatVectorOperations::add(scratch, data + 1, data + 2, n);
+    FloatVectorOperations::multiply(scratch, 9.0f / 16.0f, n);
+    FloatVectorOperations::addWithMultiply(scratch, data, -1.0f / 16.0f, n);
+    FloatVectorOperations::addWithMultiply(scratch, data + 3, -1.0f / 16.0f, n);
+
+    const auto range{ FloatVectorOperations::findMinAndMax(scratch, n) };
+
+    return jmax(-range.getStart(), range.getEnd());
+}
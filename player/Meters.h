@@ -0,0 +1,113 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "engine.h"
+#include <array>
+#include <atomic>
+
+/**
+ * Audio buses level meters and engine stats.
+ *
+ * Levels are measured by the audio thread while rendering and written
+ * at the end of each block into one of two snapshots, which is then
+ * published. Readers (script, editor) copy the published snapshot without
+ * locks: each snapshot has a version, odd while being written, which is
+ * checked before and after the copy, so that a copy overlapping a write
+ * is retried instead of mixing two blocks.
+ *
+ * True-peak is estimated from 2x oversampled signal (4-point cubic
+ * interpolation at the mid-points), which catches most of the inter-sample
+ * overs at a fraction of the cost of a proper oversampling filter.
+ */
+class Meters final
+{
+public:
+
+    constexpr static int NumBuses = tonewheel::NUM_BUSES;
+
+    enum BusField
+    {
+        PeakL,
+        PeakR,
+        RmsL,
+        RmsR,
+        TruePeakL,
+        TruePeakR,
+        NumBusFields
+    };
+
+    enum StatsField
+    {
+        ActiveVoices,
+        ProcessLoad,
+        NumStatsFields
+    };
+
+    struct Snapshot
+    {
+        std::array<float, NumBuses * NumBusFields> buses{};
+        std::array<float, NumStatsFields> stats{};
+    };
+
+    Meters();
+
+    /// Copy the most recently published snapshot. This is lock-free.
+    void readSnapshot(Snapshot& snapshot) const noexcept;
+
+    /// Most recently published bus field value.
+    float getBusValue(int bus, BusField field) const noexcept;
+
+    /**
+     * Bus levels held since the previous call.
+     * Peaks are the maximum over all the blocks processed since then,
+     * RMS is the most recent value. This is meant for a single UI reader.
+     */
+    void takeHeldLevels(int bus, std::array<float, NumBusFields>& levels) noexcept;
+
+    /**
+     * Clear the meters.
+     *
+     * @note This must only be called when the audio thread is not running.
+     */
+    void reset();
+
+    // Audio thread interface
+
+    /// Measure a rendered chunk of a bus.
+    void measureBus(int bus, const float* left, const float* right, int numFrames) noexcept;
+
+    /// Publish the measured levels.
+    void endBlock(int numFrames, float activeVoices, float processLoad) noexcept;
+
+private:
+
+    static float sumOfSquares(const float* data, int numFrames) noexcept;
+    static float interpolatedPeak(const float* data, float* scratch, int numFrames) noexcept;
+
+    // Snapshot written by the audio thread, relaxed atomics guarded by the version
+    struct SharedSnapshot
+    {
+        std::array<std::atomic<float>, NumBuses * NumBusFields> buses;
+        std::array<std::atomic<float>, NumStatsFields> stats;
+        std::atomic<uint32> version{ 0 };
+    };
+
+    std::array<SharedSnapshot, 2> snapshots;
+    std::atomic<int> published{ 0 };
+
+    std::array<std::atomic<float>, NumBuses * NumBusFields> held;
+
+    // Audio thread only
+    struct Accumulator
+    {
+        float peakL;
+        float peakR;
+        float sumSquaresL;
+        float sumSquaresR;
+        float truePeakL;
+        float truePeakR;
+    };
+
+    std::array<Accumulator, NumBuses> accumulators;
+    std::array<float, tonewheel::MIX_BUFFER_NUM_FRAMES> scratch;
+};
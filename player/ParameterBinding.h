@@ -0,0 +1,90 @@
+#pragma once
+
+#include "audio_parameter.h"
+#include "ParameterQueue.h"
+#include <array>
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * Native binding of a normalised 0..1 control value
+ * onto an audio parameter range.
+ */
+struct ParameterBinding
+{
+    enum class Curve
+    {
+        Linear,
+        Exponential     // Requires strictly positive range, e.g. frequency
+    };
+
+    tonewheel::AudioParameter* parameter{ nullptr };
+    float min{ 0.0f };
+    float max{ 1.0f };
+    Curve curve{ Curve::Linear };
+
+    float map(float x) const noexcept
+    {
+        if (curve == Curve::Exponential && min > 0.0f && max > 0.0f)
+            return min * std::pow(max / min, x);
+
+        return min + (max - min) * x;
+    }
+
+    /// Apply the control value on the audio thread.
+    void apply(ParameterQueue& queue, float x) const
+    {
+        queue.setValue(parameter, map(x));
+    }
+
+    /// Post the control value from the script thread.
+    bool post(ParameterQueue& queue, float x) const
+    {
+        return queue.post(parameter, map(x));
+    }
+};
+
+/**
+ * Bindings of numbered controls (MIDI controllers, host parameters),
+ * built on the script thread and published to the audio thread.
+ */
+template <int NumControls>
+struct ParameterBindingTable
+{
+    std::vector<ParameterBinding> bindings;             // Sorted by control
+    std::array<int, NumControls + 1> offsets{};         // Per-control ranges
+
+    /// Build the table, bindings of a control keep their order.
+    static std::unique_ptr<ParameterBindingTable> build(const std::vector<std::pair<int, ParameterBinding>>& controlBindings)
+    {
+        auto table{ std::make_unique<ParameterBindingTable>() };
+
+        for (const auto& [control, binding] : controlBindings)
+            ++table->offsets[(size_t)control + 1];
+
+        for (size_t i = 1; i < table->offsets.size(); ++i)
+            table->offsets[i] += table->offsets[i - 1];
+
+        auto next{ table->offsets };
+        table->bindings.resize(controlBindings.size());
+
+        for (const auto& [control, binding] : controlBindings)
+            table->bindings[(size_t)next[(size_t)control]++] = binding;
+
+        return table;
+    }
+
+    bool isBound(int control) const noexcept
+    {
+        return offsets[(size_t)control + 1] > offsets[(size_t)control];
+    }
+
+    /// Apply the control value to its bindings on the audio thread.
+    void apply(int control, ParameterQueue& queue, float x) const
+    {
+        for (int i = offsets[(size_t)control]; i < offsets[(size_t)control + 1]; ++i)
+            bindings[(size_t)i].apply(queue, x);
+    }
+};
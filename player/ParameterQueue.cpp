@@ -0,0 +1,193 @@
+#include "ParameterQueue.h"
+#include <algorithm>
+#include <cmath>
+
+ParameterQueue::ParameterQueue()
+{
+    postedValues.reserve(QueueSize + MaxPending);
+}
+
+bool ParameterQueue::post(tonewheel::AudioParameter* param, float value, double delay, double ramp, Ramp shape)
+{
+    if (param == nullptr)
+        return true;
+
+    const double sr{ sampleRate.load(std::memory_order_relaxed) };
+
+    Change change{};
+    change.parameter = param;
+    change.value = value;
+    change.time = delay > 0.0 ? position.load(std::memory_order_relaxed) + (int64_t)std::llround(delay * sr) : Now;
+    change.rampLength = ramp > 0.0 ? (int)std::llround(ramp * sr) : 0;
+    change.shape = shape;
+    change.sequence = postSequence + 1;
+
+    // Never written here on overflow, the audio thread may be writing the parameter
+    if (!queue.send(change))
+        return false;
+
+    ++postSequence;
+
+    if (change.time == Now && change.rampLength == 0) {
+        prunePostedValues();
+
+        auto it{ std::find_if(postedValues.begin(), postedValues.end(), [param](const auto& v) { return v.parameter == param; }) };
+
+        if (it != postedValues.end())
+            *it = { param, value, change.sequence };
+        else
+            postedValues.push_back({ param, value, change.sequence });
+    }
+
+    return true;
+}
+
+float ParameterQueue::getValue(tonewheel::AudioParameter* param)
+{
+    jassert(param != nullptr);
+
+    prunePostedValues();
+
+    for (const auto& posted : postedValues) {
+        if (posted.parameter == param)
+            return posted.value;
+    }
+
+    return param->getTargetValue();
+}
+
+void ParameterQueue::prunePostedValues()
+{
+    const auto applied{ appliedSequence.load(std::memory_order_acquire) };
+
+    postedValues.erase(std::remove_if(postedValues.begin(), postedValues.end(),
+        [applied](const auto& v) { return v.sequence <= applied; }), postedValues.end());
+}
+
+void ParameterQueue::reset()
+{
+    Change change{};
+
+    while (queue.receive(change)) {}
+
+    numPending = 0;
+    numRamps = 0;
+    blockStart = 0;
+    position = 0;
+
+    postedValues.clear();
+    postSequence = 0;
+    receivedSequence = 0;
+    appliedSequence = 0;
+}
+
+void ParameterQueue::beginBlock(float sr)
+{
+    if (sr > 0.0f)
+        sampleRate.store(sr, std::memory_order_relaxed);
+
+    Change change{};
+
+    while (numPending < MaxPending && queue.receive(change)) {
+        pending[(size_t)numPending++] = change;
+        receivedSequence = change.sequence;
+    }
+}
+
+int ParameterQueue::process(int sampleIndex, int numFrames)
+{
+    const int64_t now{ blockStart + sampleIndex };
+    int64_t next{ std::numeric_limits<int64_t>::max() };
+    int n{ 0 };
+
+    // Changes are applied in the order they have been posted
+    for (int i = 0; i < numPending; ++i) {
+        const auto& change{ pending[(size_t)i] };
+
+        if (change.time <= now) {
+            apply(change);
+        } else {
+            next = std::min(next, change.time);
+            pending[(size_t)n++] = change;
+        }
+    }
+
+    numPending = n;
+
+    if (next - now < numFrames)
+        numFrames = (int)(next - now);
+
+    return numFrames;
+}
+
+void ParameterQueue::advance(int numFrames)
+{
+    int n{ 0 };
+
+    for (int i = 0; i < numRamps; ++i) {
+        auto ramp{ ramps[(size_t)i] };
+
+        ramp.elapsed = std::min(ramp.length, ramp.elapsed + numFrames);
+        const float t{ float(ramp.elapsed) / float(ramp.length) };
+
+        float value{};
+
+        if (ramp.shape == Ramp::Exponential && ramp.startValue * ramp.endValue > 0.0f)
+            value = ramp.startValue * std::pow(ramp.endValue / ramp.startValue, t);
+        else
+            value = ramp.startValue + (ramp.endValue - ramp.startValue) * t;
+
+        ramp.parameter->setValue(value);
+
+        if (ramp.elapsed < ramp.length)
+            ramps[(size_t)n++] = ramp;
+    }
+
+    numRamps = n;
+}
+
+void ParameterQueue::setValue(tonewheel::AudioParameter* param, float value)
+{
+    if (param == nullptr)
+        return;
+
+    Change change{};
+    change.parameter = param;
+    change.value = value;
+
+    apply(change);
+}
+
+void ParameterQueue::endBlock(int numFrames)
+{
+    blockStart += numFrames;
+    position.store(blockStart, std::memory_order_relaxed);
+
+    // The immediate changes received have all been applied by now
+    appliedSequence.store(receivedSequence, std::memory_order_release);
+}
+
+void ParameterQueue::apply(const Change& change)
+{
+    // A new change overrides the parameter ramp in progress
+    for (int i = 0; i < numRamps; ++i) {
+        if (ramps[(size_t)i].parameter == change.parameter) {
+            ramps[(size_t)i] = ramps[(size_t)--numRamps];
+            break;
+        }
+    }
+
+    if (change.rampLength <= 0 || numRamps == MaxRamps) {
+        change.parameter->setValue(change.value);
+        return;
+    }
+
+    ramps[(size_t)numRamps++] = {
+        change.parameter,
+        change.parameter->getTargetValue(),
+        change.value,
+        change.rampLength,
+        0,
+        change.shape
+    };
+}
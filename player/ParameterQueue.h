@@ -0,0 +1,144 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "audio_parameter.h"
+#include "core/ring_buffer.h"
+#include <array>
+#include <atomic>
+#include <limits>
+#include <vector>
+
+/**
+ * Timestamped audio parameter changes queue.
+ *
+ * Parameter writes from the script are not applied directly but posted
+ * to a single-producer lock-free queue. The audio thread applies them
+ * at their sample time (splitting the rendering into chunks as needed),
+ * optionally ramping the value over a number of chunks.
+ *
+ * All the parameter writers go through the queue (the native controllers
+ * and host parameters via setValue() on the audio thread), so that the
+ * last write always wins over a ramp in progress.
+ */
+class ParameterQueue final
+{
+public:
+
+    constexpr static int QueueSize = 1024;
+    constexpr static int MaxPending = 1024;
+    constexpr static int MaxRamps = 256;
+
+    enum class Ramp
+    {
+        Linear,
+        Exponential
+    };
+
+    ParameterQueue();
+
+    /**
+     * Post a parameter change.
+     * This must be called on the script thread.
+     *
+     * @param param   Parameter to be changed.
+     * @param value   Target value.
+     * @param delay   Delay in seconds before applying the change, 0 - as soon as possible.
+     * @param ramp    Ramp duration in seconds, 0 - no ramp.
+     * @param shape   Ramp shape.
+     *
+     * @return false if the queue is full and the change has been dropped.
+     */
+    bool post(tonewheel::AudioParameter* param, float value, double delay = 0.0, double ramp = 0.0, Ramp shape = Ramp::Linear);
+
+    /**
+     * Parameter value as seen by the script: the last value posted without
+     * delay nor ramp until the audio thread has applied it, the parameter
+     * target value otherwise.
+     * This must be called on the script thread.
+     */
+    float getValue(tonewheel::AudioParameter* param);
+
+    /**
+     * Drop all the changes.
+     *
+     * @note This must only be called when the audio thread is not running.
+     */
+    void reset();
+
+    // Audio thread interface
+
+    void beginBlock(float sampleRate);
+
+    /**
+     * Apply the changes due at the given sample index.
+     *
+     * @return Number of frames that can be rendered before the next change.
+     */
+    int process(int sampleIndex, int numFrames);
+
+    /// Advance the active ramps by the given number of frames.
+    void advance(int numFrames);
+
+    /// Set a parameter value right away, cancelling its ramp in progress.
+    void setValue(tonewheel::AudioParameter* param, float value);
+
+    void endBlock(int numFrames);
+
+private:
+
+    constexpr static int64_t Now = -1;
+
+    struct Change
+    {
+        tonewheel::AudioParameter* parameter{ nullptr };
+        float value{ 0.0f };
+        int64_t time{ Now };        // Absolute sample time
+        int rampLength{ 0 };        // Frames
+        Ramp shape{ Ramp::Linear };
+        int64_t sequence{ 0 };
+    };
+
+    // Immediate change not yet applied by the audio thread
+    struct PostedValue
+    {
+        tonewheel::AudioParameter* parameter;
+        float value;
+        int64_t sequence;
+    };
+
+    struct ActiveRamp
+    {
+        tonewheel::AudioParameter* parameter;
+        float startValue;
+        float endValue;
+        int length;
+        int elapsed;
+        Ramp shape;
+    };
+
+    void apply(const Change& change);
+    void prunePostedValues();
+
+    tonewheel::core::RingBuffer<Change, QueueSize> queue;
+
+    std::atomic<int64_t> position{ 0 };
+    std::atomic<float> sampleRate{ 44100.0f };
+
+    // Script thread only
+    std::vector<PostedValue> postedValues;
+    int64_t postSequence{ 0 };
+
+    // Sequence of the last change received by the audio thread,
+    // published once the block has applied the immediate changes.
+    int64_t receivedSequence{ 0 };
+    std::atomic<int64_t> appliedSequence{ 0 };
+
+    // Audio thread only
+    std::array<Change, MaxPending> pending;
+    int numPending{ 0 };
+
+    std::array<ActiveRamp, MaxRamps> ramps;
+    int numRamps{ 0 };
+
+    int64_t blockStart{ 0 };
+};
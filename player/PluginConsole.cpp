@@ -1,35 +1,158 @@
 #include "PluginConsole.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 Console::Console()
     : listeners{}
-    , queue()
 {
+    for (size_t i = 0; i < QueueSize; ++i)
+        slots[i].sequence.store(i, std::memory_order_relaxed);
 }
 
-Console::~Console() = default;
+Console::~Console()
+{
+    stopTimer();
+}
 
 void Console::addListener(Listener* listener)
 {
     jassert(listener != nullptr);
     listeners.add(listener);
+
+    // Messages posted meanwhile are kept in the queue until delivered
+    if (!isTimerRunning())
+        startTimerHz(FlushRateHz);
 }
 
 void Console::removeListener(Listener* listener)
 {
     jassert(listener != nullptr);
     listeners.remove(listener);
+
+    if (listeners.isEmpty())
+        stopTimer();
 }
 
-void Console::postMessage(const String& message)
+void Console::postMessage(const String& message, Source source)
 {
-    queue.send(std::make_shared<String>(message));
-    triggerAsyncUpdate();
+    postMessage(message.toRawUTF8(), source);
+}
+
+void Console::postMessage(const char* message, Source source)
+{
+    if (message == nullptr)
+        return;
+
+    const char* ptr{ message };
+
+    do {
+        // Each line counts against the rate limit
+        if (!acquireRate(source))
+            return;
+
+        // Split into lines and then into chunks that fit into a slot
+        const char* eol{ std::strchr(ptr, '\n') };
+        size_t lineLength{ eol != nullptr ? size_t(eol - ptr) : std::strlen(ptr) };
+
+        do {
+            size_t length{ std::min(lineLength, MaxMessageLength) };
+
+            // Do not break a UTF-8 sequence
+            if (length < lineLength) {
+                while (length > 0 && (uint8_t(ptr[length]) & 0xC0) == 0x80)
+                    --length;
+
+                if (length == 0)
+                    length = MaxMessageLength;
+            }
+
+            if (!push(ptr, length)) {
+                overflowDropped.fetch_add(1, std::memory_order_relaxed);
+                totalDropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            ptr += length;
+            lineLength -= length;
+        } while (lineLength > 0);
+
+        if (eol != nullptr)
+            ptr = eol + 1;
+
+    } while (*ptr != '\0');
 }
 
-void Console::handleAsyncUpdate()
+bool Console::acquireRate(Source source) noexcept
 {
-    MessagePtr messagePtr{};
+    auto& limiter{ rateLimiters[(size_t)source] };
+
+    const auto now{ juce::Time::getMillisecondCounter() };
+    auto start{ limiter.windowStart.load(std::memory_order_relaxed) };
+
+    if (now - start >= 1000 && limiter.windowStart.compare_exchange_strong(start, now)) {
+        limiter.count.store(0, std::memory_order_relaxed);
+
+        if (const auto suppressed{ limiter.suppressed.exchange(0) }; suppressed > 0) {
+            char note[64];
+            std::snprintf(note, sizeof(note), "*** %d message(s) suppressed by rate limit ***", suppressed);
+            push(note, std::strlen(note));
+        }
+    }
+
+    if (limiter.count.fetch_add(1, std::memory_order_relaxed) >= RateLimit) {
+        limiter.suppressed.fetch_add(1, std::memory_order_relaxed);
+        totalDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+bool Console::push(const char* text, size_t length) noexcept
+{
+    auto pos{ tail.load(std::memory_order_relaxed) };
+
+    for (;;) {
+        auto& slot{ slots[pos % QueueSize] };
+        const auto seq{ slot.sequence.load(std::memory_order_acquire) };
+        const auto diff{ (intptr_t)seq - (intptr_t)pos };
+
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                std::memcpy(slot.text, text, length);
+                slot.length = (uint16_t)length;
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // Queue is full
+        } else {
+            pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Console::timerCallback()
+{
+    StringArray batch{};
+
+    for (;;) {
+        auto& slot{ slots[head % QueueSize] };
+
+        if (slot.sequence.load(std::memory_order_acquire) != head + 1)
+            break;
+
+        batch.add(String::fromUTF8(slot.text, (int)slot.length));
+        slot.sequence.store(head + QueueSize, std::memory_order_release);
+        ++head;
+    }
+
+    if (const auto dropped{ overflowDropped.exchange(0) }; dropped > 0)
+        batch.add("*** " + String(dropped) + " console message(s) dropped ***");
+
+    if (batch.isEmpty())
+        return;
 
-    while (queue.receive(messagePtr))
-        listeners.call([msg = messagePtr.get()](Listener& l) { l.consoleMessageReceived(*msg); });
+    listeners.call([&batch](Listener& l) { l.consoleMessagesReceived(batch); });
 }
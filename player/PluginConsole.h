@@ -2,18 +2,49 @@
 
 #include "JuceHeader.h"
 
-#include "core/ring_buffer.h"
-#include <mutex>
-#include <queue>
+#include <array>
+#include <atomic>
+#include <cstdint>
 
-class Console final : private juce::AsyncUpdater
+/**
+ * Console log buffer.
+ *
+ * Messages are copied into a fixed arena of slots organised as a bounded
+ * lock-free multiple-producers queue, so posting never allocates and can be
+ * done from any thread, including the audio thread. The queue is drained on
+ * the message thread by a timer and delivered to the listeners in batches.
+ * The timer only runs while there are listeners.
+ *
+ * Messages that do not fit into the queue, or lines that exceed a source's
+ * rate limit, are dropped and counted.
+ */
+class Console final : private juce::Timer
 {
 public:
 
+    /// Message origin, used for rate limiting.
+    enum class Source
+    {
+        Script = 0,
+        Engine,
+        Audio,
+
+        NumSources
+    };
+
+    constexpr static size_t QueueSize = 1024;
+    constexpr static size_t MaxMessageLength = 250;
+
+    /// Maximum number of lines per second accepted from a single source.
+    constexpr static int RateLimit = 200;
+
+    /// Listeners are updated at most this many times per second.
+    constexpr static int FlushRateHz = 30;
+
     class Listener
     {
     public:
-        virtual void consoleMessageReceived(const String& message) = 0;
+        virtual void consoleMessagesReceived(const StringArray& messages) = 0;
         virtual ~Listener() = default;
     };
 
@@ -23,15 +54,49 @@ public:
     void addListener(Listener* listener);
     void removeListener(Listener* listener);
 
-    void postMessage(const String& message);
+    void postMessage(const String& message, Source source = Source::Script);
+
+    /**
+     * Post a UTF-8 message.
+     *
+     * @note This method does not allocate memory and is safe
+     *       to be called from the audio thread. Long messages are
+     *       split into several lines.
+     */
+    void postMessage(const char* message, Source source = Source::Script);
+
+    /// Total number of messages dropped due to queue overflow or rate limiting.
+    int getNumDroppedMessages() const noexcept { return totalDropped.load(std::memory_order_relaxed); }
 
 private:
 
-    void handleAsyncUpdate() override;
+    struct Slot
+    {
+        std::atomic<size_t> sequence{ 0 };
+        uint16_t length{ 0 };
+        char text[MaxMessageLength];
+    };
+
+    struct RateLimiter
+    {
+        std::atomic<uint32_t> windowStart{ 0 };
+        std::atomic<int> count{ 0 };
+        std::atomic<int> suppressed{ 0 };
+    };
+
+    bool acquireRate(Source source) noexcept;
+    bool push(const char* text, size_t length) noexcept;
+
+    void timerCallback() override;
 
     juce::ListenerList<Listener> listeners;
 
-    using MessagePtr = std::shared_ptr<String>;
+    std::array<Slot, QueueSize> slots;
+    std::atomic<size_t> tail{ 0 };
+    size_t head{ 0 };
+
+    std::array<RateLimiter, (size_t)Source::NumSources> rateLimiters;
 
-    tonewheel::core::RingBuffer<MessagePtr, 1024> queue;
+    std::atomic<int> overflowDropped{ 0 };
+    std::atomic<int> totalDropped{ 0 };
 };
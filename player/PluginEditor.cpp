@@ -2,12 +2,14 @@
 
 TonewheelAudioProcessorEditor::TonewheelAudioProcessorEditor (TonewheelAudioProcessor& p)
     : AudioProcessorEditor (&p), audioProcessor (p)
-    , consoleMessages{}
+    , consoleLineLengths{}
+    , meterStrip(p.getMeters())
 {
     audioProcessor.addProcessorListener(this);
     audioProcessor.getConsole().addListener(this);
 
     addAndMakeVisible(viewContainer);
+    addAndMakeVisible(meterStrip);
 
     loadUI();
 
@@ -35,7 +37,9 @@ void TonewheelAudioProcessorEditor::paint (Graphics& g)
 
 void TonewheelAudioProcessorEditor::resized()
 {
-    viewContainer.setBounds(getLocalBounds());
+    auto bounds{ getLocalBounds() };
+    meterStrip.setBounds(bounds.removeFromBottom(meterStripHeight));
+    viewContainer.setBounds(bounds);
 }
 
 void TonewheelAudioProcessorEditor::timerCallback()
@@ -56,7 +60,7 @@ void TonewheelAudioProcessorEditor::timerCallback()
     }
 
     if (auto ptr{ voicesLabel.lock() }) {
-        const auto strVoices{ String(audioProcessor.getActiveVoiceCount()) };
+        const auto strVoices{ String(audioProcessor.getActiveVoiceCount()) + "/" + String(audioProcessor.getGlobalActiveVoiceCount()) };
         ptr->setAttribute(attrText, strVoices);
     }
 }
@@ -66,24 +70,40 @@ void TonewheelAudioProcessorEditor::processorStateRestored()
     updateScriptFromProcessor();
 }
 
-void TonewheelAudioProcessorEditor::consoleMessageReceived(const String& msg)
+void TonewheelAudioProcessorEditor::consoleMessagesReceived(const StringArray& messages)
 {
-    while (consoleMessages.size() >= 100)
-        consoleMessages.pop_front();
+    if (consoleEditor == nullptr) {
+        for (const auto& msg : messages)
+            DBG(msg);
 
-    consoleMessages.push_back(msg);
+        return;
+    }
+
+    // Append the new lines only, the editor content is never rebuilt
+    String text;
+
+    for (const auto& msg : messages) {
+        text << msg << "\n";
+        consoleLineLengths.push_back(msg.length() + 1);
+    }
 
-    if (consoleEditor != nullptr) {
-        String text;
+    consoleEditor->moveCaretToEnd();
+    consoleEditor->insertTextAtCaret(text);
 
-        for (const auto& line : consoleMessages)
-            text += line + "\n";
+    // Trim the oldest lines
+    int numCharsToRemove{ 0 };
 
-        consoleEditor->setText(text);
-        consoleEditor->moveCaretToEnd();
-    } else {
-        DBG(msg);
+    while ((int)consoleLineLengths.size() > maxConsoleLines) {
+        numCharsToRemove += consoleLineLengths.front();
+        consoleLineLengths.pop_front();
     }
+
+    if (numCharsToRemove > 0) {
+        consoleEditor->setHighlightedRegion({ 0, numCharsToRemove });
+        consoleEditor->insertTextAtCaret({});
+    }
+
+    consoleEditor->moveCaretToEnd();
 }
 
 void TonewheelAudioProcessorEditor::loadUI()
@@ -156,7 +176,7 @@ void TonewheelAudioProcessorEditor::updateScriptFromProcessor()
 
 void TonewheelAudioProcessorEditor::clearConsole()
 {
-    consoleMessages.clear();
+    consoleLineLengths.clear();
 
     if (consoleEditor != nullptr)
         consoleEditor->clear();
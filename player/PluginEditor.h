@@ -1,9 +1,10 @@
 #pragma once
 
 #include <JuceHeader.h>
-#include <list>
+#include <deque>
 #include "PluginProcessor.h"
 #include "PluginConsole.h"
+#include "MeterStrip.h"
 
 class TonewheelAudioProcessorEditor final : public AudioProcessorEditor,
                                             public Timer,
@@ -22,7 +23,7 @@ public:
 
     void processorStateRestored() override;
 
-    void consoleMessageReceived(const String& msg) override;
+    void consoleMessagesReceived(const StringArray& messages) override;
 
 private:
 
@@ -36,11 +37,16 @@ private:
 
     TonewheelAudioProcessor& audioProcessor;
 
-    std::list<String> consoleMessages;
+    constexpr static int maxConsoleLines = 500;
+    constexpr static int meterStripHeight = 64;
+
+    std::deque<int> consoleLineLengths;
 
     File scriptFile;
 
     vitro::ViewContainer viewContainer{};
+    MeterStrip meterStrip;
+
     std::weak_ptr<vitro::CodeEditor> codeEditor{};
 
     juce::TextEditor* consoleEditor{};
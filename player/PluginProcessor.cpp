@@ -12,6 +12,8 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "AllocationCounter.h"
+#include "ThreadConfig.h"
 
 //==============================================================================
 TonewheelAudioProcessor::TonewheelAudioProcessor()
@@ -24,6 +26,7 @@ TonewheelAudioProcessor::TonewheelAudioProcessor()
     , processLoad (0.0f)
     , dummyBuffer(tonewheel::MIX_BUFFER_NUM_CHANNELS, tonewheel::MIX_BUFFER_NUM_FRAMES)
 {
+    engineProxy.getHostParameters().addTo(*this);
 }
 
 TonewheelAudioProcessor::~TonewheelAudioProcessor()
@@ -102,6 +105,21 @@ void TonewheelAudioProcessor::changeProgramName (int index, const String& newNam
 void TonewheelAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
     engine.prepareToPlay((float)sampleRate, samplesPerBlock);
+
+    auto& sampleCache{ engineProxy.getSampleCache() };
+    sampleCache.setTargetSampleRate(sampleRate);
+
+    // The patch samples have been converted to another rate, or not at all
+    // when the patch has been loaded before the sample rate was known.
+    if (sampleCache.takeReconversionNeeded(sampleRate)) {
+        console.postMessage("Reloading the patch to convert the samples to " + String(sampleRate) + " Hz", Console::Source::Engine);
+
+        MessageManager::callAsync ([this] {
+            setPatchScript(currentScript, contentFolder);
+        });
+    }
+
+    numBlocksSincePatchLoad = 0;
     processEnabled = true;
 }
 
@@ -186,77 +204,147 @@ void TonewheelAudioProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuffe
     if (totalActiveChannels < 2 && totalActiveChannels % 2 != 0)
         return;
 
-    int numInputBusesToProcess{ totalNumInputChannels / 2 };
-    int numOutputBusesToProcess{ totalActiveChannels / 2 };
-
     // @todo This needs better synchronisation (when reloading patch).
     if (! processEnabled)
         return;
 
     inProcess = true;
     {
+        ThreadConfig::noteAudioThreadCore();
+
+        const AllocationCounter::ScopedRealtimeSection realtimeSection{};
+        const auto numAllocations{ AllocationCounter::getNumRealtimeAllocations() };
+
+        auto& scheduler{ engineProxy.getScheduler() };
+        bool isPlaying{ false };
+        tonewheel::Engine::TransportInfo transport{};
+
         if (auto* playHead{ getPlayHead() }) {
             juce::AudioPlayHead::CurrentPositionInfo posInfo{};
             playHead->getCurrentPosition(posInfo);
 
-            tonewheel::Engine::TransportInfo transport{};
             transport.bpm = posInfo.bpm;
             transport.time = posInfo.timeInSeconds;
             transport.ppqPosition = posInfo.ppqPosition;
             engine.setTransportInfo(transport);
+
+            isPlaying = posInfo.isPlaying;
         }
 
+        engineProxy.getVoiceBudget().beginBlock();
+        scheduler.beginBlock(isPlaying, transport.ppqPosition, transport.bpm, engine.getSampleRate(), buffer.getNumSamples());
+
+        auto& parameterQueue{ engineProxy.getParameterQueue() };
+        parameterQueue.beginBlock(engine.getSampleRate());
+
+        // Host automation is delivered per block
+        engineProxy.getHostParameters().process();
+
         const auto nonRT{ isNonRealtime() };
         engine.setNonRealtime (nonRT);
 
-        if (nonRT)
-            processMidiNonRealtime(midiMessages);
-        else
-            processMidi(midiMessages);
+        engineProxy.beginRealtimeBlock();
+        midiPosted = false;
+        midiTimedOut = false;
+
+        auto midiIter{ midiMessages.cbegin() };
+        const auto midiEnd{ midiMessages.cend() };
 
         int numFrames{ buffer.getNumSamples() };
         int sampleIndex{ 0 };
 
         auto& buses{ engine.getAudioBusPool() };
+        auto& meters{ engineProxy.getMeters() };
+
+        // Host channels of each engine bus, unused buses are skipped entirely.
+        // Buses dropped from the used ones keep rendering until their voices end.
+        const auto usedBuses{ engineProxy.getUsedBusesMask() | engineProxy.getVoiceBudget().getBusesWithVoices() };
+        std::array<int, tonewheel::NUM_BUSES> inputChannels{};
+        std::array<int, tonewheel::NUM_BUSES> outputChannels{};
+
+        for (int busIndex = 0; busIndex < tonewheel::NUM_BUSES; ++busIndex) {
+            const bool used{ (usedBuses & (1u << busIndex)) != 0 };
+            inputChannels[(size_t)busIndex] = used ? getHostBusChannel(true, busIndex) : -1;
+            outputChannels[(size_t)busIndex] = used ? getHostBusChannel(false, busIndex) : -1;
+
+            if (!used) {
+                if (const auto ch{ getHostBusChannel(false, busIndex) }; ch >= 0) {
+                    buffer.clear(ch, 0, buffer.getNumSamples());
+                    buffer.clear(ch + 1, 0, buffer.getNumSamples());
+                }
+            }
+        }
 
         while (numFrames > 0) {
-            engine.processAudioEvents();
-
+            // MIDI and scheduled events split the rendering into sample-accurate chunks
             int processThisTime{ std::min(numFrames, tonewheel::MIX_BUFFER_NUM_FRAMES) };
-            int channelIndex{ 0 };
-
-            for (int busIndex = 0; busIndex < buses.getNumBuses(); ++busIndex) {
-                if (busIndex < numInputBusesToProcess) {
-                    // Feed input into the send buffer
-                    const float* inL = buffer.getReadPointer(channelIndex, sampleIndex);
-                    const float* inR = buffer.getReadPointer(channelIndex + 1, sampleIndex);
-                    auto& sendBuffer{ buses[busIndex].getSendBuffer() };
-                    float* sendL{ sendBuffer.getChannelData(0) };
-                    float* sendR{ sendBuffer.getChannelData(1) };
-
-                    for (int i = 0; i < processThisTime; ++i) {
-                        sendL[i] += inL[i];
-                        sendR[i] += inR[i];
-                    }
-                }
+            processThisTime = processMidi(midiIter, midiEnd, sampleIndex, processThisTime, nonRT);
+            processThisTime = scheduler.process(sampleIndex, processThisTime);
+            processThisTime = parameterQueue.process(sampleIndex, processThisTime);
+
+            engineProxy.getControllerMap().advance(processThisTime, engine.getSampleRate());
+            parameterQueue.advance(processThisTime);
+
+            engineProxy.processAudioEvents();
+
+            const int numBuses{ jmin(buses.getNumBuses(), tonewheel::NUM_BUSES) };
 
-                if (busIndex < numOutputBusesToProcess) {
+            // Inputs are all fed before rendering, since input and output
+            // buses may share the same host channels.
+            for (int busIndex = 0; busIndex < numBuses; ++busIndex) {
+                const auto channelIndex{ inputChannels[(size_t)busIndex] };
+
+                if (channelIndex < 0)
+                    continue;
+
+                // Feed input into the send buffer
+                const float* inL = buffer.getReadPointer(channelIndex, sampleIndex);
+                const float* inR = buffer.getReadPointer(channelIndex + 1, sampleIndex);
+                auto& sendBuffer{ buses[busIndex].getSendBuffer() };
+                FloatVectorOperations::add(sendBuffer.getChannelData(0), inL, processThisTime);
+                FloatVectorOperations::add(sendBuffer.getChannelData(1), inR, processThisTime);
+            }
+
+            for (int busIndex = 0; busIndex < numBuses; ++busIndex) {
+                if ((usedBuses & (1u << busIndex)) == 0)
+                    continue;
+
+                const auto channelIndex{ outputChannels[(size_t)busIndex] };
+
+                if (channelIndex >= 0) {
                     float* outL = buffer.getWritePointer(channelIndex, sampleIndex);
                     float* outR = buffer.getWritePointer(channelIndex + 1, sampleIndex);
                     ::memset(outL, 0, sizeof(float) * (size_t)processThisTime);
                     ::memset(outR, 0, sizeof(float) * (size_t)processThisTime);
                     buses[busIndex].processAndMix(outL, outR, processThisTime);
+                    meters.measureBus(busIndex, outL, outR, processThisTime);
                 } else {
                     // Process inaudible but to a dummy buffer
+                    dummyBuffer.clear(0, processThisTime);
                     buses[busIndex].processAndMix(dummyBuffer.getWritePointer(0), dummyBuffer.getWritePointer(1), processThisTime);
+                    meters.measureBus(busIndex, dummyBuffer.getReadPointer(0), dummyBuffer.getReadPointer(1), processThisTime);
                 }
-
-                channelIndex += 2;
             }
 
             sampleIndex += processThisTime;
             numFrames -= processThisTime;
         }
+
+        scheduler.endBlock(buffer.getNumSamples());
+        parameterQueue.endBlock(buffer.getNumSamples());
+        meters.endBlock(buffer.getNumSamples(), (float) getActiveVoiceCount(), processLoad);
+
+        if (midiPosted)
+            engineProxy.notify();
+
+        // No heap allocations nor frees are expected in the steady state,
+        // the realtime script handler is not counted (see processMidiRealtime())
+        if (numBlocksSincePatchLoad < allocationsWarmUpBlocks)
+            ++numBlocksSincePatchLoad;
+        else
+            jassert(AllocationCounter::getNumRealtimeAllocations() == numAllocations);
+
+        ignoreUnused (numAllocations);
     } // inProcess
 
     inProcess = false;
@@ -272,6 +360,12 @@ void TonewheelAudioProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuffe
 
 AudioProcessor::BusesProperties TonewheelAudioProcessor::getBusesProperties()
 {
+    // The host sees all the buses, active. The used buses are only known once
+    // a patch is loaded, long after the host has queried the layout, and the
+    // plugin cannot reliably make the host change it afterwards (most hosts
+    // only apply layouts they request). Defaulting the extra buses to inactive
+    // would silently route multi-output patches into the dummy buffer instead.
+    // Buses left out by engine.useBuses() are cleared once per block.
     BusesProperties buses;
 
     for (int i = 0; i < tonewheel::NUM_BUSES; ++i)
@@ -283,32 +377,52 @@ AudioProcessor::BusesProperties TonewheelAudioProcessor::getBusesProperties()
     return buses;
 }
 
-void TonewheelAudioProcessor::processMidi(MidiBuffer& midiMessages)
+int TonewheelAudioProcessor::getHostBusChannel(bool isInput, int busIndex)
 {
-    if (midiMessages.getNumEvents() == 0)
-        return;
+    if (busIndex >= getBusCount(isInput))
+        return -1;
 
-    for (auto msgIter : midiMessages) {
-        const auto msg{ msgIter.getMessage() };
+    auto* bus{ getBus(isInput, busIndex) };
 
-        tonewheel::MidiMessage m(msg.getRawData(), (size_t) msg.getRawDataSize(), msg.getTimeStamp());
-        engineProxy.postMidiMessage(m, false);
-    }
+    if (bus == nullptr || !bus->isEnabled() || bus->getNumberOfChannels() != 2)
+        return -1;
 
-    engineProxy.notify();
+    return getChannelIndexInProcessBlockBuffer(isInput, busIndex, 0);
 }
 
-void TonewheelAudioProcessor::processMidiNonRealtime(MidiBuffer& midiMessages)
+int TonewheelAudioProcessor::processMidi(MidiBufferIterator& it, const MidiBufferIterator& end, int sampleIndex, int numFrames, bool nonRealtime)
 {
-    if (midiMessages.getNumEvents() == 0)
-        return;
+    for (; it != end; ++it) {
+        const auto metadata{ *it };
+
+        // Messages past this point are processed on the following chunks
+        if (metadata.samplePosition > sampleIndex)
+            return jmin(numFrames, metadata.samplePosition - sampleIndex);
+
+        const auto msg{ metadata.getMessage() };
+
+        engineProxy.getSamplePrefetcher().processMidi(msg);
+
+        // Zones and controllers are handled natively without involving the script
+        if (engineProxy.getZoneMap().process(msg) || engineProxy.getControllerMap().process(msg))
+            continue;
+
+        if (nonRealtime) {
+            if (!midiTimedOut && !engineProxy.sendMidiMessage(msg))
+                midiTimedOut = true; // Abort processing if timing out
 
-    for (auto msgIter : midiMessages) {
-        const auto msg{ msgIter.getMessage() };
+            continue;
+        }
+
+        if (engineProxy.processMidiRealtime(msg.getRawData(), msg.getRawDataSize()))
+            continue;
 
-        if (!engineProxy.sendMidiMessage(msg))
-            break; // Abort processing it timing out
+        tonewheel::MidiMessage m(msg.getRawData(), (size_t) msg.getRawDataSize(), msg.getTimeStamp());
+        engineProxy.postMidiMessage(m, false);
+        midiPosted = true;
     }
+
+    return numFrames;
 }
 
 //==============================================================================
@@ -328,6 +442,12 @@ void TonewheelAudioProcessor::getStateInformation(MemoryBlock& destData)
     MemoryOutputStream os (destData, true);
     os.writeString (currentScript);
     os.writeString (contentFolder.getFullPathName());
+
+    auto& hostParameters{ engineProxy.getHostParameters() };
+    os.writeInt (HostParameters::NumParameters);
+
+    for (int i = 0; i < HostParameters::NumParameters; ++i)
+        os.writeFloat (hostParameters.getValue(i));
 }
 
 void TonewheelAudioProcessor::setStateInformation(const void* data, int sizeInBytes)
@@ -336,6 +456,18 @@ void TonewheelAudioProcessor::setStateInformation(const void* data, int sizeInBy
     const auto script = is.readString();
     const auto path = is.readString();
 
+    // Host parameters values are restored before the script declares them
+    if (! is.isExhausted()) {
+        const int numParams = is.readInt();
+
+        for (int i = 0; i < numParams && ! is.isExhausted(); ++i) {
+            const float value = is.readFloat();
+
+            if (auto* param{ engineProxy.getHostParameters().getParameter(i) })
+                param->restoreValue(value);
+        }
+    }
+
     setPatchScript(script, File(path));
 
     notifyStateRestored();
@@ -356,6 +488,11 @@ void TonewheelAudioProcessor::getPrebufferStatus(int& loaded, int& total) const
 }
 
 int TonewheelAudioProcessor::getActiveVoiceCount() const noexcept
+{
+    return engineProxy.getVoiceBudget().getNumVoices();
+}
+
+int TonewheelAudioProcessor::getGlobalActiveVoiceCount() const noexcept
 {
     return tonewheel::GlobalEngine::getInstance()->getVoicePool().getNumActiveVoices();
 }
@@ -386,9 +523,11 @@ void TonewheelAudioProcessor::setPatchScript(const String& script, const File& d
     auto* g{ tonewheel::GlobalEngine::getInstance() };
     auto& samplePool{ g->getSamplePool() };
     samplePool.preload(tonewheel::DEFAULT_STREAM_BUFFER_SIZE);
+    engineProxy.getSamplePrefetcher().setPreloadFrames(tonewheel::DEFAULT_STREAM_BUFFER_SIZE);
 
     engine.prepareToPlay();
 
+    numBlocksSincePatchLoad = 0;
     processEnabled = true;
 }
 
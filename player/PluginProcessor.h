@@ -13,6 +13,7 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "EngineProxy.h"
 #include "PluginConsole.h"
+#include <array>
 #include <memory>
 #include <thread>
 #include "engine.h"
@@ -72,7 +73,11 @@ public:
     tonewheel::Engine& getEngine() noexcept { return engine; }
 
     float getProcessLoad() const noexcept { return processLoad; }
+    /// Voices held by this plugin instance.
     int getActiveVoiceCount() const noexcept;
+
+    /// Voices active in the process, all the instances together.
+    int getGlobalActiveVoiceCount() const noexcept;
     void getPrebufferStatus (int& loaded, int& total) const;
 
     void setPatchScript(const String& script, const File& dir = {});
@@ -82,6 +87,8 @@ public:
 
     Console& getConsole() noexcept { return console; }
 
+    Meters& getMeters() noexcept { return engineProxy.getMeters(); }
+
     void addProcessorListener (Listener* listener);
     void removeProcessorListener (Listener* listener);
 
@@ -89,8 +96,15 @@ private:
 
     static BusesProperties getBusesProperties();
 
-    void processMidi (MidiBuffer& midiMessages);
-    void processMidiNonRealtime (MidiBuffer& midiMessages);
+    /// First channel of a stereo host bus in the process buffer, -1 if the bus is disabled.
+    int getHostBusChannel (bool isInput, int busIndex);
+
+    /**
+     * Process the MIDI messages due at the given sample index.
+     *
+     * @return Number of frames that can be rendered before the next message.
+     */
+    int processMidi (MidiBufferIterator& it, const MidiBufferIterator& end, int sampleIndex, int numFrames, bool nonRealtime);
 
     void notifyStateRestored();
 
@@ -103,6 +117,14 @@ private:
 
     std::atomic<float> processLoad;
 
+    // Blocks processed since the patch load, heap allocations
+    // on the audio thread are not expected past the warm-up.
+    constexpr static int allocationsWarmUpBlocks = 16;
+    std::atomic<int> numBlocksSincePatchLoad{ 0 };
+
+    bool midiPosted{ false };
+    bool midiTimedOut{ false };
+
     AudioBuffer<float> dummyBuffer;
 
     String currentScript;
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+/**
+ * Object published by a non-realtime thread to the audio thread.
+ *
+ * The audio thread accesses the object via ScopedAccess and never blocks
+ * nor frees memory. The publishing thread swaps the object and waits for
+ * the audio thread to stop using the previous one before deleting it.
+ *
+ * @note Only a single audio thread reader is supported.
+ */
+template <class T>
+class RealtimePublisher final
+{
+public:
+
+    RealtimePublisher() = default;
+
+    ~RealtimePublisher()
+    {
+        delete object.exchange(nullptr);
+    }
+
+    void publish(std::unique_ptr<T> newObject)
+    {
+        auto* oldObject{ object.exchange(newObject.release()) };
+
+        while (inUse.load())
+            std::this_thread::yield();
+
+        delete oldObject;
+    }
+
+    /**
+     * Delete the published object.
+     *
+     * @note This must only be called when the audio thread is not running.
+     */
+    void reset()
+    {
+        delete object.exchange(nullptr);
+    }
+
+    class ScopedAccess final
+    {
+    public:
+        explicit ScopedAccess(RealtimePublisher& p) noexcept
+            : publisher{ p }
+        {
+            publisher.inUse.store(true);
+            ptr = publisher.object.load();
+        }
+
+        ~ScopedAccess()
+        {
+            publisher.inUse.store(false);
+        }
+
+        T* get() const noexcept { return ptr; }
+        T* operator->() const noexcept { return ptr; }
+        explicit operator bool() const noexcept { return ptr != nullptr; }
+
+        ScopedAccess(const ScopedAccess&) = delete;
+        ScopedAccess& operator=(const ScopedAccess&) = delete;
+
+    private:
+        RealtimePublisher& publisher;
+        T* ptr{ nullptr };
+    };
+
+private:
+
+    std::atomic<T*> object{ nullptr };
+    std::atomic<bool> inUse{ false };
+};
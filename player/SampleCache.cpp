@@ -0,0 +1,459 @@
+#include "SampleCache.h"
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+
+//==============================================================================
+
+/**
+ * Polyphase windowed-sinc (Kaiser) resampler.
+ *
+ * The kernel is tabulated for a fixed number of phases, with linear
+ * interpolation between the adjacent phases. The cut-off follows the
+ * lower of the two rates, so that downsampling does not alias.
+ * The number of taps is padded to a multiple of the accumulator lanes
+ * (with zero-weight taps), so that the dot products need no tail loop.
+ */
+class SincResampler final
+{
+public:
+
+    constexpr static int NumPhases = 256;
+    constexpr static int HalfTaps = 32;
+    constexpr static double Beta = 9.0;
+    constexpr static double Passband = 0.95;
+    constexpr static int NumLanes = 8;
+
+    SincResampler(double ratio)
+        : step{ 1.0 / ratio }
+    {
+        const double cutoff{ jmin(1.0, ratio) * Passband };
+
+        halfWidth = (int)std::ceil(HalfTaps / jmin(1.0, ratio));
+        numTaps = (halfWidth * 2 + NumLanes - 1) / NumLanes * NumLanes;
+
+        kernel.resize((size_t)(NumPhases + 1) * (size_t)numTaps);
+
+        const double norm{ besselI0(Beta) };
+
+        for (int p = 0; p <= NumPhases; ++p) {
+            float* k{ &kernel[(size_t)p * (size_t)numTaps] };
+
+            for (int i = 0; i < numTaps; ++i) {
+                // Distance from the output position to the input tap
+                const double x{ (double)(i - halfWidth + 1) - (double)p / NumPhases };
+                const double w{ x / halfWidth };
+                const double window{ std::abs(w) < 1.0 ? besselI0(Beta * std::sqrt(1.0 - w * w)) / norm : 0.0 };
+                const double t{ MathConstants<double>::pi * cutoff * x };
+                const double sinc{ x == 0.0 ? 1.0 : std::sin(t) / t };
+
+                k[i] = (float)(cutoff * sinc * window);
+            }
+        }
+    }
+
+    /// Output length for the given input length.
+    int64 getOutputLength(int64 inputLength) const noexcept
+    {
+        return (int64)std::ceil((double)inputLength / step);
+    }
+
+    /**
+     * Render a range of output frames of a channel.
+     * Ranges are independent, so that they can be rendered in parallel.
+     */
+    void process(const float* input, int64 inputLength, float* output, int64 begin, int64 end) const noexcept
+    {
+        for (int64 n = begin; n < end; ++n) {
+            const double t{ (double)n * step };
+            const int64 pos{ (int64)t };
+            const double phase{ (t - (double)pos) * NumPhases };
+            const int p{ (int)phase };
+            const float a{ (float)(phase - p) };
+
+            const float* k0{ &kernel[(size_t)p * (size_t)numTaps] };
+            const float* k1{ k0 + numTaps };
+
+            const int64 first{ pos - halfWidth + 1 };
+            float acc0{ 0.0f };
+            float acc1{ 0.0f };
+
+            if (first >= 0 && first + numTaps <= inputLength) {
+                // Contiguous taps, independent partial sums let the compiler vectorise the loop
+                const float* in{ input + first };
+                float sums0[NumLanes]{};
+                float sums1[NumLanes]{};
+
+                for (int i = 0; i < numTaps; i += NumLanes) {
+                    for (int j = 0; j < NumLanes; ++j) {
+                        sums0[j] += in[i + j] * k0[i + j];
+                        sums1[j] += in[i + j] * k1[i + j];
+                    }
+                }
+
+                for (int j = 0; j < NumLanes; ++j) {
+                    acc0 += sums0[j];
+                    acc1 += sums1[j];
+                }
+            } else {
+                for (int i = 0; i < numTaps; ++i) {
+                    const int64 j{ first + i };
+
+                    if (j >= 0 && j < inputLength) {
+                        acc0 += input[j] * k0[i];
+                        acc1 += input[j] * k1[i];
+                    }
+                }
+            }
+
+            output[n] = acc0 + (acc1 - acc0) * a;
+        }
+    }
+
+private:
+
+    static double besselI0(double x)
+    {
+        double sum{ 1.0 };
+        double term{ 1.0 };
+        const double q{ x * x * 0.25 };
+
+        for (int k = 1; k < 64 && term > sum * 1.0e-12; ++k) {
+            term *= q / ((double)k * (double)k);
+            sum += term;
+        }
+
+        return sum;
+    }
+
+    double step;
+    int halfWidth;
+    int numTaps;
+    std::vector<float> kernel;
+};
+
+//==============================================================================
+
+/// Resampling worker threads, shared by all the plugin instances.
+struct ResamplingThreads
+{
+    ThreadPool pool{ jlimit(1, 16, SystemStats::getNumCpus()) };
+};
+
+//==============================================================================
+
+SampleCache::SampleCache()
+{
+    formatManager.registerBasicFormats();
+
+    setDirectory(File::getSpecialLocation(File::userApplicationDataDirectory)
+        .getChildFile("Tonewheel")
+        .getChildFile("SampleCache"));
+}
+
+SampleCache::~SampleCache() = default;
+
+void SampleCache::setDirectory(const File& dir)
+{
+    directory = dir;
+}
+
+void SampleCache::setResampling(bool shouldResample) noexcept
+{
+    resampling = shouldResample;
+    resolvedSampleRate = -1.0;
+}
+
+bool SampleCache::takeReconversionNeeded(double rate) noexcept
+{
+    double resolved{ resolvedSampleRate.load() };
+
+    if (!isResampling() || resolved < 0.0 || resolved == rate)
+        return false;
+
+    return resolvedSampleRate.compare_exchange_strong(resolved, -1.0);
+}
+
+std::string SampleCache::resolve(const std::string& path, double* rateRatio)
+{
+    const File source{ String(path) };
+    const bool decode{ source.hasFileExtension("flac") };
+    const double rate{ isResampling() ? getTargetSampleRate() : 0.0 };
+
+    if (rateRatio != nullptr)
+        *rateRatio = 1.0;
+
+    // Tracked so that the samples can be converted again once the rate is known
+    if (isResampling())
+        resolvedSampleRate = rate;
+
+    // WAV files are streamed by the engine directly
+    if (!decode && rate <= 0.0)
+        return path;
+
+    if (!source.existsAsFile()) {
+        lastError = "Sample file not found " + source.getFullPathName();
+        return {};
+    }
+
+    if (rate > 0.0) {
+        std::unique_ptr<AudioFormatReader> reader{ formatManager.createReaderFor(source) };
+
+        if (reader == nullptr) {
+            lastError = "Unable to read " + source.getFullPathName();
+            return {};
+        }
+
+        if (reader->sampleRate > 0.0 && reader->sampleRate != rate) {
+            const auto cached{ getCachedFile(source, "rate" + String(rate)) };
+
+            if (!cached.existsAsFile() && !resample(source, cached, rate))
+                return {};
+
+            if (rateRatio != nullptr)
+                *rateRatio = rate / reader->sampleRate;
+
+            return cached.getFullPathName().toStdString();
+        }
+
+        if (!decode)
+            return path;
+    }
+
+    const auto cached{ getCachedFile(source, {}) };
+
+    if (cached.existsAsFile())
+        return cached.getFullPathName().toStdString();
+
+    if (!convert(source, cached))
+        return {};
+
+    return cached.getFullPathName().toStdString();
+}
+
+std::string SampleCache::resolveLoop(const std::string& path, int loopBegin, int loopEnd, int xfade, double* rateRatio)
+{
+    const File source{ String(path) };
+
+    if (xfade <= 0)
+        return resolve(path, rateRatio);
+
+    // Loop points refer to the source sample, which is not resampled then
+    if (rateRatio != nullptr)
+        *rateRatio = 1.0;
+
+    if (!source.existsAsFile()) {
+        lastError = "Sample file not found " + source.getFullPathName();
+        return {};
+    }
+
+    const auto cached{ getCachedFile(source, "loop" + String(loopBegin) + ":" + String(loopEnd) + ":" + String(xfade)) };
+
+    if (cached.existsAsFile())
+        return cached.getFullPathName().toStdString();
+
+    const bool ok{ write(source, cached, [&](AudioFormatReader& reader, AudioFormatWriter& writer) {
+        if (loopBegin < 0 || loopEnd <= loopBegin || loopEnd > reader.lengthInSamples) {
+            lastError = "Invalid loop range " + String(loopBegin) + ".." + String(loopEnd);
+            return false;
+        }
+
+        // Cross-fade cannot extend before the sample start nor exceed the loop
+        const int length{ jmin(xfade, loopBegin, loopEnd - loopBegin) };
+
+        AudioBuffer<float> tail((int)reader.numChannels, length);
+        AudioBuffer<float> head((int)reader.numChannels, length);
+
+        reader.read(&tail, 0, length, loopEnd - length, true, true);
+        reader.read(&head, 0, length, loopBegin - length, true, true);
+
+        // Fade the loop tail into the material preceding the loop begin,
+        // so that the loop end joins the loop begin seamlessly.
+        for (int ch = 0; ch < tail.getNumChannels(); ++ch) {
+            auto* t{ tail.getWritePointer(ch) };
+            const auto* h{ head.getReadPointer(ch) };
+
+            for (int i = 0; i < length; ++i) {
+                const float g{ (float(i) + 0.5f) / float(length) };
+                t[i] += (h[i] - t[i]) * g;
+            }
+        }
+
+        return writer.writeFromAudioReader(reader, 0, loopEnd - length)
+            && writer.writeFromAudioSampleBuffer(tail, 0, length)
+            && writer.writeFromAudioReader(reader, loopEnd, reader.lengthInSamples - loopEnd);
+    }) };
+
+    return ok ? cached.getFullPathName().toStdString() : std::string();
+}
+
+bool SampleCache::convert(const File& source, const File& target)
+{
+    return write(source, target, [&](AudioFormatReader& reader, AudioFormatWriter& writer) {
+        // Transcode by blocks, samples can be large
+        if (!writer.writeFromAudioReader(reader, 0, reader.lengthInSamples)) {
+            lastError = "Unable to transcode " + source.getFullPathName();
+            return false;
+        }
+
+        return true;
+    });
+}
+
+bool SampleCache::write(const File& source, const File& target, const WriteFunc& func, double rate)
+{
+    std::unique_ptr<AudioFormatReader> reader{ formatManager.createReaderFor(source) };
+
+    if (reader == nullptr) {
+        lastError = "Unable to read " + source.getFullPathName();
+        return false;
+    }
+
+    auto* format{ formatManager.findFormatForFileExtension(target.getFileExtension()) };
+
+    if (format == nullptr) {
+        lastError = "Unsupported format " + target.getFileExtension();
+        return false;
+    }
+
+    if (!target.getParentDirectory().createDirectory()) {
+        lastError = "Unable to create " + target.getParentDirectory().getFullPathName();
+        return false;
+    }
+
+    // Write into a temporary file first, so that an interrupted
+    // conversion never leaves a truncated file behind.
+    TemporaryFile temp{ target };
+
+    {
+        std::unique_ptr<OutputStream> stream{ temp.getFile().createOutputStream() };
+
+        if (stream == nullptr) {
+            lastError = "Unable to write " + target.getFullPathName();
+            return false;
+        }
+
+        const int bitsPerSample{ reader->usesFloatingPointData ? 32 : jmin(24, (int)reader->bitsPerSample) };
+
+        if (!format->getPossibleBitDepths().contains(bitsPerSample)) {
+            lastError = "Unable to encode " + String(bitsPerSample) + (reader->usesFloatingPointData ? "-bit float" : "-bit")
+                + " samples as " + target.getFileExtension();
+            return false;
+        }
+
+        // Loop and cue positions refer to the source frames
+        const auto metadata{ rate > 0.0 && rate != reader->sampleRate
+            ? scaleMetadata(reader->metadataValues, reader->sampleRate, rate)
+            : reader->metadataValues };
+
+        std::unique_ptr<AudioFormatWriter> writer{ format->createWriterFor(stream.get(),
+            rate > 0.0 ? rate : reader->sampleRate, reader->numChannels, bitsPerSample, metadata, 0) };
+
+        if (writer == nullptr) {
+            lastError = "Unable to encode " + target.getFullPathName();
+            return false;
+        }
+
+        stream.release(); // Owned by the writer now
+
+        if (!func(*reader, *writer))
+            return false;
+    }
+
+    if (!temp.overwriteTargetFileWithTemporary()) {
+        lastError = "Unable to write " + target.getFullPathName();
+        return false;
+    }
+
+    return true;
+}
+
+bool SampleCache::resample(const File& source, const File& target, double rate)
+{
+    return write(source, target, [&](AudioFormatReader& reader, AudioFormatWriter& writer) {
+        if (reader.lengthInSamples > std::numeric_limits<int>::max()) {
+            lastError = "Sample is too long to resample " + source.getFullPathName();
+            return false;
+        }
+
+        const int inputLength{ (int)reader.lengthInSamples };
+        const int numChannels{ (int)reader.numChannels };
+
+        AudioBuffer<float> input(numChannels, inputLength);
+        reader.read(&input, 0, inputLength, 0, true, true);
+
+        const SincResampler resampler(rate / reader.sampleRate);
+        const int outputLength{ (int)resampler.getOutputLength(inputLength) };
+
+        AudioBuffer<float> output(numChannels, outputLength);
+
+        // Split the output frames across the shared worker threads
+        auto& pool{ resamplingThreads->pool };
+        const int numWorkers{ pool.getNumThreads() };
+        const int64 chunk{ ((int64)outputLength * numChannels + numWorkers - 1) / numWorkers };
+
+        std::atomic<int> numPending{ numWorkers };
+        WaitableEvent done;
+
+        for (int w = 0; w < numWorkers; ++w) {
+            pool.addJob([&, w]() {
+                const int64 begin{ chunk * w };
+                const int64 end{ jmin(chunk * (w + 1), (int64)outputLength * numChannels) };
+
+                for (int ch = 0; ch < numChannels; ++ch) {
+                    const int64 chBegin{ jmax(begin, (int64)ch * outputLength) };
+                    const int64 chEnd{ jmin(end, (int64)(ch + 1) * outputLength) };
+
+                    if (chBegin < chEnd)
+                        resampler.process(input.getReadPointer(ch), inputLength, output.getWritePointer(ch),
+                                          chBegin - (int64)ch * outputLength, chEnd - (int64)ch * outputLength);
+                }
+
+                if (--numPending == 0)
+                    done.signal();
+            });
+        }
+
+        done.wait();
+
+        return writer.writeFromAudioSampleBuffer(output, 0, outputLength);
+    }, rate);
+}
+
+StringPairArray SampleCache::scaleMetadata(const StringPairArray& metadata, double sourceRate, double rate)
+{
+    StringPairArray scaled{ metadata };
+
+    if (sourceRate <= 0.0)
+        return scaled;
+
+    const double ratio{ rate / sourceRate };
+
+    for (const auto& key : metadata.getAllKeys()) {
+        // smpl loops, cue points and labelled regions (WAV metadata keys)
+        const bool isPosition{ (key.startsWith("Loop") && (key.endsWith("Start") || key.endsWith("End")))
+            || (key.startsWith("Cue") && !key.startsWith("CueLabel") && !key.startsWith("CueNote") && key.endsWith("Offset"))
+            || (key.startsWith("CueRegion") && key.endsWith("SampleLength")) };
+
+        if (isPosition)
+            scaled.set(key, String(std::llround(metadata[key].getLargeIntValue() * ratio)));
+        else if (key.startsWith("Loop") && key.endsWith("Fraction"))
+            scaled.set(key, "0");
+    }
+
+    if (metadata.containsKey("SamplePeriod"))
+        scaled.set("SamplePeriod", String(std::llround(1.0e9 / rate)));
+
+    return scaled;
+}
+
+File SampleCache::getCachedFile(const File& source, const String& suffix) const
+{
+    const auto key{ source.getFullPathName()
+        + String(source.getSize())
+        + String(source.getLastModificationTime().toMilliseconds())
+        + suffix };
+
+    return directory.getChildFile(String::toHexString(key.hashCode64()) + ".wav");
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+#include <functional>
+#include <string>
+
+struct ResamplingThreads;
+
+/**
+ * On-disk cache of samples prepared for the engine.
+ *
+ * The engine sample pool streams WAV files only. Samples stored in other
+ * formats (FLAC) are decoded once into the cache and the engine is given
+ * the cached WAV file instead. This is a storage and distribution format
+ * conversion: the engine still streams uncompressed data, so the streaming
+ * I/O is the same as with WAV files. Cached files are keyed by the source
+ * path, size and modification time, so they are rebuilt when the source changes.
+ * Looped samples can have their loop cross-fade rendered into the cached file.
+ * Optionally, samples are converted offline to the engine sample rate, so that
+ * the voices play them at native speed.
+ */
+class SampleCache final
+{
+public:
+
+    SampleCache();
+    ~SampleCache();
+
+    /// Cache location, defaults to the user application data folder.
+    void setDirectory(const File& dir);
+    const File& getDirectory() const noexcept { return directory; }
+
+    /// Engine sample rate, set on prepareToPlay().
+    void setTargetSampleRate(double rate) noexcept { targetSampleRate = rate; }
+    double getTargetSampleRate() const noexcept { return targetSampleRate.load(); }
+
+    /// Convert the samples to the engine sample rate, disabled by default.
+    void setResampling(bool shouldResample) noexcept;
+    bool isResampling() const noexcept { return resampling.load(); }
+
+    /**
+     * Whether the samples resolved since resampling was enabled have been
+     * converted to another rate than the given one, or not converted at all
+     * because the engine sample rate was not known yet (e.g. the host
+     * restoring the state before preparing the plugin).
+     * This returns true only once, the patch is expected to be reloaded.
+     */
+    bool takeReconversionNeeded(double rate) noexcept;
+
+    /**
+     * Resolve a sample path into the file to be loaded by the engine.
+     * This must be called on the script thread, as it may decode the sample.
+     *
+     * @param rateRatio Receives the cached to source sample rate ratio,
+     *                  to be applied to the sample positions.
+     *
+     * @return Path to load, empty string if the sample cannot be prepared.
+     */
+    std::string resolve(const std::string& path, double* rateRatio = nullptr);
+
+    /**
+     * Resolve a looped sample into a file with the loop cross-fade pre-rendered.
+     * The material before the loop end is faded into the material before the
+     * loop begin, so that the voice can play the loop without cross-fading.
+     * Such samples are not resampled, so that the loop points stay valid.
+     *
+     * @return Path to load, empty string if the sample cannot be prepared.
+     */
+    std::string resolveLoop(const std::string& path, int loopBegin, int loopEnd, int xfade, double* rateRatio = nullptr);
+
+    /// Last error message, if a sample cannot be prepared.
+    const String& getLastError() const noexcept { return lastError; }
+
+    /**
+     * Transcode an audio file, the formats are deduced from the file extensions
+     * (e.g. WAV to FLAC for packing a library, FLAC to WAV for unpacking it).
+     * Floating point samples are kept as such, they cannot be packed to FLAC.
+     *
+     * @return true on success.
+     */
+    bool convert(const File& source, const File& target);
+
+private:
+
+    using WriteFunc = std::function<bool(AudioFormatReader&, AudioFormatWriter&)>;
+
+    /**
+     * Write target file from the source one, using a temporary file.
+     * Target sample rate is the source one, unless specified. Integer samples
+     * are written with up to 24 bits, floating point ones as 32-bit float.
+     */
+    bool write(const File& source, const File& target, const WriteFunc& func, double rate = 0.0);
+
+    /// Write target file from the source one resampled.
+    bool resample(const File& source, const File& target, double rate);
+
+    File getCachedFile(const File& source, const String& suffix) const;
+
+    /// Sample positions metadata (loops, cues) scaled to the resampled rate.
+    static StringPairArray scaleMetadata(const StringPairArray& metadata, double sourceRate, double rate);
+
+    File directory;
+    AudioFormatManager formatManager;
+    String lastError;
+
+    std::atomic<double> targetSampleRate{ 0.0 };
+    std::atomic<bool> resampling{ false };
+
+    // Target rate the samples have been resolved at, -1 when none
+    std::atomic<double> resolvedSampleRate{ -1.0 };
+
+    SharedResourcePointer<ResamplingThreads> resamplingThreads;
+};
@@ -0,0 +1,364 @@
+#include "SamplePrefetcher.h"
+#include <algorithm>
+#include <cstring>
+
+void SamplePrefetcher::Stats::reset() noexcept
+{
+    numPrefetched = 0;
+    numBytes = 0;
+    numHits = 0;
+    numLate = 0;
+    numMisses = 0;
+}
+
+String SamplePrefetcher::Stats::toString() const
+{
+    const auto hits{ numHits.load() };
+    const auto triggers{ hits + numLate.load() + numMisses.load() };
+    const double hitRate{ triggers > 0 ? 100.0 * (double)hits / (double)triggers : 0.0 };
+
+    return String(numPrefetched.load()) + " prefetched ("
+        + String((double)numBytes.load() / (1024.0 * 1024.0), 1) + " MB), hit rate "
+        + String(hitRate, 1) + "%, "
+        + String(numLate.load()) + " late, "
+        + String(numMisses.load()) + " missed";
+}
+
+//==============================================================================
+
+SamplePrefetcher::SamplePrefetcher()
+    : juce::Thread("SamplePrefetcher")
+    , states{ new std::atomic<uint8>[MaxSamples] }
+    , prefetchTimes{ new std::atomic<int64>[MaxSamples] }
+    , scratch(64 * 1024)
+{
+    for (auto& key : heldKeys)
+        key = 0;
+
+    for (int i = 0; i < MaxSamples; ++i) {
+        states[i] = None;
+        prefetchTimes[i] = 0;
+    }
+}
+
+SamplePrefetcher::~SamplePrefetcher()
+{
+    stopThread(-1);
+}
+
+void SamplePrefetcher::setSettings(const Settings& s)
+{
+    {
+        const SpinLock::ScopedLockType scopedLock(lock);
+        settings = s;
+        settings.keyRange = jlimit(0, NumKeys, settings.keyRange);
+        settings.velocityRange = jlimit(0, 127, settings.velocityRange);
+        settings.bytes = jmax((int64)0, settings.bytes);
+    }
+
+    enabled = s.enabled;
+
+    if (s.enabled && !isThreadRunning())
+        startThread(3); // Below the script thread
+    else if (!s.enabled && isThreadRunning())
+        stopThread(-1);
+}
+
+SamplePrefetcher::Settings SamplePrefetcher::getSettings() const
+{
+    const SpinLock::ScopedLockType scopedLock(lock);
+    return settings;
+}
+
+bool SamplePrefetcher::addSample(int sampleId, const File& file)
+{
+    if (sampleId < 0 || sampleId >= MaxSamples)
+        return false;
+
+    const SpinLock::ScopedLockType scopedLock(lock);
+
+    if ((size_t)sampleId >= files.size())
+        files.resize((size_t)sampleId + 1);
+
+    files[(size_t)sampleId] = file;
+
+    return true;
+}
+
+void SamplePrefetcher::setZones(const std::vector<ZoneMap::Zone>& z)
+{
+    const SpinLock::ScopedLockType scopedLock(lock);
+    zones = z;
+}
+
+void SamplePrefetcher::hint(int sampleId)
+{
+    if (!isEnabled() || sampleId < 0 || sampleId >= MaxSamples)
+        return;
+
+    {
+        const SpinLock::ScopedLockType scopedLock(lock);
+        hints.push_back(sampleId);
+    }
+
+    // Only the first pending notification is timed
+    int64 expected{ 0 };
+    notifyTicks.compare_exchange_strong(expected, Time::getHighResolutionTicks());
+
+    notify();
+}
+
+void SamplePrefetcher::processMidi(const MidiMessage& msg) noexcept
+{
+    if (!isEnabled())
+        return;
+
+    if (msg.isNoteOn())
+        heldKeys[(size_t)msg.getNoteNumber()].store(msg.getVelocity(), std::memory_order_relaxed);
+    else if (msg.isNoteOff())
+        heldKeys[(size_t)msg.getNoteNumber()].store(0, std::memory_order_relaxed);
+    else
+        return;
+
+    heldKeysGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void SamplePrefetcher::noteTrigger(int sampleId) noexcept
+{
+    if (!isEnabled() || sampleId < 0 || sampleId >= MaxSamples)
+        return;
+
+    switch (states[sampleId].load(std::memory_order_acquire)) {
+    case Prefetched:
+        // The file cache may have been evicted since
+        if (Time::currentTimeMillis() - prefetchTimes[sampleId].load(std::memory_order_relaxed) < expiryTime_ms)
+            ++stats.numHits;
+        else
+            ++stats.numMisses;
+        break;
+    case Pending:
+        ++stats.numLate;
+        break;
+    default:
+        ++stats.numMisses;
+        break;
+    }
+}
+
+void SamplePrefetcher::reset()
+{
+    {
+        const SpinLock::ScopedLockType scopedLock(lock);
+        files.clear();
+        zones.clear();
+        hints.clear();
+    }
+
+    layouts.clear();
+
+    for (auto& key : heldKeys)
+        key = 0;
+
+    for (int i = 0; i < MaxSamples; ++i) {
+        states[i] = None;
+        prefetchTimes[i] = 0;
+    }
+
+    stats.reset();
+}
+
+void SamplePrefetcher::run()
+{
+    std::vector<int> candidates;
+    uint32 generation{ heldKeysGeneration.load() - 1 };
+
+    threadStats.reset();
+    applyThreadPolicy();
+
+    while (!threadShouldExit()) {
+        wait(pollInterval_ms);
+        recordWakeup();
+
+        // The host audio thread may have moved since the policy was applied
+        if (ThreadConfig::getAudioCoresMask() != appliedAudioCoresMask)
+            applyThreadPolicy();
+
+        candidates.clear();
+
+        {
+            const SpinLock::ScopedLockType scopedLock(lock);
+            candidates.swap(hints);
+        }
+
+        // Predict from the keyboard only when the held keys change
+        const auto currentGeneration{ heldKeysGeneration.load(std::memory_order_acquire) };
+
+        if (currentGeneration != generation) {
+            generation = currentGeneration;
+            collectCandidates(candidates);
+        }
+
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        const auto now{ Time::currentTimeMillis() };
+
+        for (const auto sampleId : candidates) {
+            if (threadShouldExit())
+                break;
+
+            if (states[sampleId].load() == Prefetched && now - prefetchTimes[sampleId].load() < expiryTime_ms)
+                continue;
+
+            prefetch(sampleId);
+        }
+    }
+}
+
+String SamplePrefetcher::getThreadPolicy() const
+{
+    const SpinLock::ScopedLockType scopedLock(lock);
+    return appliedThreadPolicy;
+}
+
+void SamplePrefetcher::applyThreadPolicy()
+{
+    appliedAudioCoresMask = ThreadConfig::getAudioCoresMask();
+    const auto applied{ ThreadConfig::applyToCurrentThread({}) };
+
+    const SpinLock::ScopedLockType scopedLock(lock);
+    appliedThreadPolicy = applied;
+}
+
+void SamplePrefetcher::recordWakeup()
+{
+    if (const auto ticks{ notifyTicks.exchange(0) }; ticks != 0) {
+        const auto latency_ms{ 1000.0 * Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - ticks) };
+        threadStats.addWakeup(latency_ms, wakeupDeadline_ms);
+    }
+}
+
+SamplePrefetcher::DataLayout SamplePrefetcher::parseLayout(FileInputStream& stream)
+{
+    // Unknown layout, prefetch from the file start
+    DataLayout layout{ true, 0, 0 };
+
+    char riff[12]{};
+
+    if (stream.read(riff, 12) != 12
+        || (std::memcmp(riff, "RIFF", 4) != 0 && std::memcmp(riff, "RF64", 4) != 0)
+        || std::memcmp(riff + 8, "WAVE", 4) != 0)
+        return layout;
+
+    int frameSize{ 0 };
+
+    // Walk the chunks up to the sample data
+    while (!stream.isExhausted()) {
+        char id[4]{};
+
+        if (stream.read(id, 4) != 4)
+            break;
+
+        // RF64 data chunk size is in the ds64 chunk, it is not needed here
+        const auto size{ (int64)(uint32)stream.readInt() };
+        const auto start{ stream.getPosition() };
+
+        if (std::memcmp(id, "fmt ", 4) == 0 && size >= 16) {
+            stream.skipNextBytes(12);   // Format tag, channels, rate, byte rate
+            frameSize = (int)(uint16)stream.readShort();
+        } else if (std::memcmp(id, "data", 4) == 0) {
+            if (frameSize > 0)
+                layout.dataStart = start;
+
+            layout.frameSize = frameSize;
+            break;
+        }
+
+        // Chunks are word-aligned
+        stream.setPosition(start + size + (size & 1));
+    }
+
+    return layout;
+}
+
+void SamplePrefetcher::collectCandidates(std::vector<int>& candidates)
+{
+    const SpinLock::ScopedLockType scopedLock(lock);
+
+    for (int key = 0; key < NumKeys; ++key) {
+        const int velocity{ heldKeys[(size_t)key].load(std::memory_order_relaxed) };
+
+        if (velocity == 0)
+            continue;
+
+        const int keyLow{ key - settings.keyRange };
+        const int keyHigh{ key + settings.keyRange };
+        const int velocityLow{ velocity - settings.velocityRange };
+        const int velocityHigh{ velocity + settings.velocityRange };
+
+        for (const auto& zone : zones) {
+            if (zone.keyHigh < keyLow || zone.keyLow > keyHigh)
+                continue;
+
+            if (zone.velocityHigh < velocityLow || zone.velocityLow > velocityHigh)
+                continue;
+
+            const int sampleId{ (int)zone.sampleId };
+
+            if (sampleId >= 0 && sampleId < MaxSamples)
+                candidates.push_back(sampleId);
+        }
+    }
+}
+
+void SamplePrefetcher::prefetch(int sampleId)
+{
+    File file{};
+    int64 bytes{ 0 };
+
+    {
+        const SpinLock::ScopedLockType scopedLock(lock);
+
+        if ((size_t)sampleId < files.size())
+            file = files[(size_t)sampleId];
+
+        bytes = settings.bytes;
+    }
+
+    if (file == File())
+        return;
+
+    states[sampleId].store(Pending, std::memory_order_release);
+
+    // Reading the file brings it into the system file cache
+    FileInputStream stream{ file };
+    int64 numRead{ 0 };
+
+    if (stream.openedOk()) {
+        if ((size_t)sampleId >= layouts.size())
+            layouts.resize((size_t)sampleId + 1);
+
+        auto& layout{ layouts[(size_t)sampleId] };
+
+        if (!layout.parsed)
+            layout = parseLayout(stream);
+
+        // The head is resident in the sample pool already, read what follows it
+        stream.setPosition(layout.dataStart + preloadFrames.load(std::memory_order_relaxed) * layout.frameSize);
+
+        while (numRead < bytes && !threadShouldExit()) {
+            const int n{ stream.read(scratch.data(), (int)jmin((int64)scratch.size(), bytes - numRead)) };
+
+            if (n <= 0)
+                break;
+
+            numRead += n;
+        }
+    }
+
+    prefetchTimes[sampleId] = Time::currentTimeMillis();
+    states[sampleId].store(Prefetched, std::memory_order_release);
+
+    ++stats.numPrefetched;
+    stats.numBytes += numRead;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "ThreadConfig.h"
+#include "ZoneMap.h"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+ * Predictive sample files prefetch.
+ *
+ * When enabled, a background thread reads ahead the sample data right after
+ * the head preloaded by the engine sample pool, for the sample files likely
+ * to be triggered next, so that the engine streaming finds it in the system
+ * file cache. Predictions come from the zones covering the keys neighbouring
+ * the held ones (within the current velocity range), and from the triggers
+ * scheduled by the script.
+ *
+ * Each trigger is accounted as a hit (sample prefetched recently enough to
+ * still be cached), late (prefetch still in progress) or miss (sample not
+ * predicted, or its prefetch has expired).
+ *
+ * Only the first MaxSamples sample IDs are tracked, the state is allocated
+ * once so that the audio thread can account the triggers lock-free.
+ *
+ * The thread keeps off the host audio thread cores, with a normal priority,
+ * and times its wake-ups on the hints like the script thread.
+ */
+class SamplePrefetcher final : private juce::Thread
+{
+public:
+
+    constexpr static int MaxSamples = 65536;
+    constexpr static int NumKeys = ZoneMap::NumKeys;
+
+    struct Settings
+    {
+        bool enabled{ false };
+        int64 bytes{ 1 << 20 };     // Bytes read ahead per sample file
+        int keyRange{ 2 };          // Neighbouring keys to predict
+        int velocityRange{ 16 };    // Velocity spread around the held keys
+    };
+
+    struct Stats
+    {
+        std::atomic<int64> numPrefetched{ 0 };
+        std::atomic<int64> numBytes{ 0 };
+        std::atomic<int64> numHits{ 0 };
+        std::atomic<int64> numLate{ 0 };
+        std::atomic<int64> numMisses{ 0 };
+
+        void reset() noexcept;
+
+        String toString() const;
+    };
+
+    SamplePrefetcher();
+    ~SamplePrefetcher();
+
+    /// Apply the settings, starting or stopping the prefetch thread.
+    void setSettings(const Settings& s);
+    Settings getSettings() const;
+
+    bool isEnabled() const noexcept { return enabled.load(std::memory_order_relaxed); }
+
+    /**
+     * Register a sample file by its engine ID.
+     *
+     * @return false if the ID is beyond MaxSamples, the sample is not prefetched then.
+     */
+    bool addSample(int sampleId, const File& file);
+
+    /// Number of frames preloaded by the engine sample pool, skipped by the prefetch.
+    void setPreloadFrames(int64 frames) noexcept { preloadFrames = jmax((int64)0, frames); }
+
+    /// Zones used to predict the samples from the held keys.
+    void setZones(const std::vector<ZoneMap::Zone>& zones);
+
+    /// Hint a sample that is about to be triggered (e.g. scheduled).
+    void hint(int sampleId);
+
+    /**
+     * Track the held keys.
+     * This is lock-free and is called on the audio thread.
+     */
+    void processMidi(const MidiMessage& msg) noexcept;
+
+    /**
+     * Account a sample trigger.
+     * This is lock-free and can be called on any thread.
+     */
+    void noteTrigger(int sampleId) noexcept;
+
+    const Stats& getStats() const noexcept { return stats; }
+
+    /// Prefetch thread wake-up statistics.
+    const ThreadConfig::Stats& getThreadStats() const noexcept { return threadStats; }
+
+    /// Scheduling policy actually applied to the prefetch thread.
+    String getThreadPolicy() const;
+
+    /**
+     * Forget the samples, zones and statistics.
+     *
+     * @note This must only be called when neither the script
+     *       nor the audio threads are running.
+     */
+    void reset();
+
+private:
+
+    enum State : uint8
+    {
+        None,
+        Pending,
+        Prefetched
+    };
+
+    // Prefetch is repeated after this time, as the file cache may have been evicted
+    constexpr static int64 expiryTime_ms = 30000;
+
+    constexpr static int pollInterval_ms = 10;
+
+    // Prefetch thread should wake up within this time after a hint
+    constexpr static double wakeupDeadline_ms = 10.0;
+
+    void run() override;
+
+    void applyThreadPolicy();
+    void recordWakeup();
+
+    // Sample data location within a WAV file
+    struct DataLayout
+    {
+        bool parsed{ false };
+        int64 dataStart{ 0 };
+        int frameSize{ 0 };
+    };
+
+    static DataLayout parseLayout(FileInputStream& stream);
+
+    void collectCandidates(std::vector<int>& candidates);
+    void prefetch(int sampleId);
+
+    std::atomic<bool> enabled{ false };
+    std::atomic<int64> preloadFrames{ 0 };
+
+    mutable SpinLock lock;
+    Settings settings{};
+    std::vector<File> files;
+    std::vector<ZoneMap::Zone> zones;
+    std::vector<int> hints;
+
+    // Held keys velocity, 0 - not held
+    std::array<std::atomic<uint8>, NumKeys> heldKeys;
+    std::atomic<uint32> heldKeysGeneration{ 0 };
+
+    std::unique_ptr<std::atomic<uint8>[]> states;
+    std::unique_ptr<std::atomic<int64>[]> prefetchTimes;
+
+    // Prefetch thread only
+    std::vector<DataLayout> layouts;
+    std::vector<char> scratch;
+
+    Stats stats{};
+
+    ThreadConfig::Stats threadStats{};
+    uint64 appliedAudioCoresMask{ 0 };
+    String appliedThreadPolicy{};
+    std::atomic<int64> notifyTicks{ 0 };
+};
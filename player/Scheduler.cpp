@@ -0,0 +1,223 @@
+#include "Scheduler.h"
+#include <cmath>
+
+Scheduler::Scheduler(VoiceBudget& budget, ParameterQueue& paramQueue)
+    : voiceBudget{ budget }
+    , parameterQueue{ paramQueue }
+{
+    freeList.reserve(NumEvents);
+    reset();
+}
+
+Scheduler::Event* Scheduler::obtainEvent()
+{
+    int slot{};
+
+    while (recycleQueue.receive(slot))
+        freeList.push_back(slot);
+
+    if (freeList.empty())
+        return nullptr;
+
+    slot = freeList.back();
+    freeList.pop_back();
+
+    // Whatever is left from the previous use gets destroyed here,
+    // on the script thread.
+    auto& event{ events[(size_t)slot] };
+    event = Event{};
+
+    generationCounter = (generationCounter + 1) % MaxGeneration;
+    event.generation = generationCounter;
+
+    return &event;
+}
+
+int Scheduler::post(Event* event)
+{
+    jassert(event != nullptr);
+
+    const auto slot{ int(event - events.data()) };
+    jassert(slot >= 0 && slot < NumEvents);
+
+    postQueue.send(slot);
+
+    return slot + NumEvents * event->generation;
+}
+
+void Scheduler::discardEvent(Event* event)
+{
+    jassert(event != nullptr);
+
+    const auto slot{ int(event - events.data()) };
+    jassert(slot >= 0 && slot < NumEvents);
+
+    freeList.push_back(slot);
+}
+
+void Scheduler::cancelAll()
+{
+    cancelRequested = true;
+}
+
+void Scheduler::reset()
+{
+    int slot{};
+
+    while (postQueue.receive(slot)) {}
+    while (recycleQueue.receive(slot)) {}
+
+    freeList.clear();
+
+    for (int i = NumEvents - 1; i >= 0; --i) {
+        events[(size_t)i] = Event{};
+        freeList.push_back(i);
+    }
+
+    executedGeneration.fill(-1);
+    executedVoiceId.fill(-1);
+
+    numPending = 0;
+    samplePosition = 0;
+    hasExpectedPpq = false;
+    expectedPpq = 0.0;
+    cancelRequested = false;
+    clock = 0.0;
+}
+
+void Scheduler::beginBlock(bool isPlaying, double ppqPosition, double bpm, double sr, int numFrames)
+{
+    if (sr > 0.0)
+        sampleRate = sr;
+
+    if (cancelRequested.exchange(false))
+        cancelPending(false);
+
+    // Events posted before a jump are cancelled along with the pending ones
+    int slot{};
+
+    while (numPending < NumEvents && postQueue.receive(slot))
+        pending[(size_t)numPending++] = { slot, NotDue };
+
+    const double samplesPerQuarter{ bpm > 0.0 ? sampleRate * 60.0 / bpm : 0.0 };
+
+    if (isPlaying && samplesPerQuarter > 0.0) {
+        if (hasExpectedPpq && std::abs(ppqPosition - expectedPpq) > jumpTolerance)
+            cancelPending(true);
+
+        expectedPpq = ppqPosition + numFrames / samplesPerQuarter;
+        hasExpectedPpq = true;
+    } else if (!isPlaying) {
+        // Relocating while stopped is not a jump, the events scheduled
+        // meanwhile refer to the position playback starts from.
+        hasExpectedPpq = false;
+    }
+
+    // Resolve the events timing within this block
+    for (int i = 0; i < numPending; ++i) {
+        auto& p{ pending[(size_t)i] };
+        const auto& event{ events[(size_t)p.slot] };
+
+        int64_t due{ NotDue };
+
+        if (event.timeBase == TimeBase::Seconds)
+            due = std::llround(event.time * sampleRate) - samplePosition;
+        else if (isPlaying && samplesPerQuarter > 0.0)
+            due = std::llround((event.time - ppqPosition) * samplesPerQuarter);
+
+        p.offset = due < numFrames ? (int)std::max(int64_t{ 0 }, due) : NotDue;
+    }
+}
+
+int Scheduler::process(int sampleIndex, int numFrames)
+{
+    int next{ NotDue };
+    int n{ 0 };
+
+    for (int i = 0; i < numPending; ++i) {
+        const auto p{ pending[(size_t)i] };
+
+        if (p.offset <= sampleIndex) {
+            execute(p.slot);
+            recycle(p.slot);
+        } else {
+            next = std::min(next, p.offset);
+            pending[(size_t)n++] = p;
+        }
+    }
+
+    numPending = n;
+
+    if (next != NotDue)
+        numFrames = std::min(numFrames, next - sampleIndex);
+
+    return numFrames;
+}
+
+void Scheduler::endBlock(int numFrames)
+{
+    samplePosition += numFrames;
+    clock.store(double(samplePosition) / sampleRate, std::memory_order_relaxed);
+}
+
+void Scheduler::execute(int slot)
+{
+    auto& event{ events[(size_t)slot] };
+
+    switch (event.action) {
+    case Action::Trigger:
+        executedVoiceId[(size_t)slot] = voiceBudget.triggerVoice(event.trigger);
+        executedGeneration[(size_t)slot] = event.generation;
+        break;
+    case Action::Release: {
+        const auto targetSlot{ (size_t)(event.target % NumEvents) };
+
+        if (event.target >= 0 && executedGeneration[targetSlot] == event.target / NumEvents)
+            releaseVoice(executedVoiceId[targetSlot], event.releaseTime);
+
+        break;
+    }
+    case Action::ReleaseVoice:
+        releaseVoice(event.target, event.releaseTime);
+        break;
+    case Action::SetParameter:
+        // Through the queue, so that a ramp in progress does not override the value
+        parameterQueue.setValue(event.parameter, event.value);
+        break;
+    default:
+        break;
+    }
+}
+
+void Scheduler::releaseVoice(int voiceId, float releaseTime)
+{
+    voiceBudget.releaseVoice(voiceId, releaseTime);
+}
+
+void Scheduler::recycle(int slot)
+{
+    recycleQueue.send(slot);
+}
+
+void Scheduler::cancelPending(bool ppqOnly)
+{
+    int n{ 0 };
+
+    for (int i = 0; i < numPending; ++i) {
+        const auto p{ pending[(size_t)i] };
+        const auto& event{ events[(size_t)p.slot] };
+
+        if (ppqOnly && event.timeBase != TimeBase::Ppq) {
+            pending[(size_t)n++] = p;
+            continue;
+        }
+
+        // Never leave a voice hanging
+        if (event.action == Action::Release || event.action == Action::ReleaseVoice)
+            execute(p.slot);
+
+        recycle(p.slot);
+    }
+
+    numPending = n;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "engine.h"
+#include "audio_parameter.h"
+#include "core/ring_buffer.h"
+#include "VoiceBudget.h"
+#include "ParameterQueue.h"
+#include <array>
+#include <atomic>
+#include <limits>
+#include <vector>
+
+/**
+ * Musical-time events scheduler.
+ *
+ * Events are prepared on the script thread in a preallocated pool and passed
+ * to the audio thread via a lock-free queue. The audio thread executes them
+ * at the exact sample frame, splitting the rendering into chunks at the
+ * events boundaries. Events timed in PPQ are cancelled when the transport
+ * jumps; pending releases are executed immediately in that case so that
+ * no voice is left hanging.
+ */
+class Scheduler final
+{
+public:
+
+    constexpr static int NumEvents = 1024;
+
+    enum class TimeBase
+    {
+        Ppq,        // Host transport position in quarter notes
+        Seconds     // Scheduler clock, see getClock()
+    };
+
+    enum class Action
+    {
+        Trigger,
+        Release,        // Release the voice of a scheduled trigger
+        ReleaseVoice,   // Release the voice by its ID
+        SetParameter
+    };
+
+    struct Event
+    {
+        TimeBase timeBase{ TimeBase::Ppq };
+        double time{ 0.0 };
+        Action action{ Action::Trigger };
+        tonewheel::Engine::Trigger trigger{};
+        int target{ -1 };
+        float releaseTime{ -1.0f };
+        tonewheel::AudioParameter* parameter{ nullptr };
+        float value{ 0.0f };
+        int generation{ 0 };
+    };
+
+    Scheduler(VoiceBudget& budget, ParameterQueue& paramQueue);
+
+    /**
+     * Obtain an event from the pool.
+     * This must be called on the script thread.
+     *
+     * @return nullptr if the pool is exhausted.
+     */
+    Event* obtainEvent();
+
+    /**
+     * Pass the event to the audio thread.
+     *
+     * @return Event handle.
+     */
+    int post(Event* event);
+
+    /// Return an obtained event back to the pool without posting it.
+    void discardEvent(Event* event);
+
+    /// Cancel all pending events.
+    void cancelAll();
+
+    /// Scheduler clock in seconds, updated on each processed block.
+    double getClock() const noexcept { return clock.load(std::memory_order_relaxed); }
+
+    /**
+     * Drop all the events.
+     *
+     * @note This must only be called when neither the script
+     *       nor the audio threads are running.
+     */
+    void reset();
+
+    // Audio thread interface
+
+    void beginBlock(bool isPlaying, double ppqPosition, double bpm, double sampleRate, int numFrames);
+
+    /**
+     * Execute the events due at the given sample index.
+     *
+     * @return Number of frames that can be rendered before the next event.
+     */
+    int process(int sampleIndex, int numFrames);
+
+    void endBlock(int numFrames);
+
+private:
+
+    void execute(int slot);
+    void releaseVoice(int voiceId, float releaseTime);
+    void recycle(int slot);
+    void cancelPending(bool ppqOnly);
+
+    constexpr static int NotDue = std::numeric_limits<int>::max();
+    constexpr static int MaxGeneration = std::numeric_limits<int>::max() / NumEvents;
+    constexpr static double jumpTolerance = 1.0e-3;
+
+    VoiceBudget& voiceBudget;
+    ParameterQueue& parameterQueue;
+
+    std::array<Event, NumEvents> events;
+
+    // Script thread only
+    std::vector<int> freeList;
+    int generationCounter{ 0 };
+
+    tonewheel::core::RingBuffer<int, NumEvents * 2> postQueue;
+    tonewheel::core::RingBuffer<int, NumEvents * 2> recycleQueue;
+    std::atomic<bool> cancelRequested{ false };
+
+    // Audio thread only
+    struct Pending
+    {
+        int slot;
+        int offset;
+    };
+
+    std::array<Pending, NumEvents> pending;
+    int numPending{ 0 };
+
+    std::array<int, NumEvents> executedGeneration;
+    std::array<int, NumEvents> executedVoiceId;
+
+    int64_t samplePosition{ 0 };
+    double sampleRate{ 44100.0 };
+    bool hasExpectedPpq{ false };
+    double expectedPpq{ 0.0 };
+
+    std::atomic<double> clock{ 0.0 };
+};
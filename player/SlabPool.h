@@ -0,0 +1,206 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+/**
+ * Pool of fixed-size memory blocks.
+ *
+ * Blocks are allocated in chunks that are never returned to the system
+ * while the pool exists. Freed blocks go onto a lock-free stack, so the
+ * memory can be released from any thread (e.g. the audio thread dropping
+ * a voice) without locking the system allocator. Allocation is meant for
+ * non-realtime threads, since the pool grows when exhausted.
+ */
+template <size_t BlockSize>
+class SlabPool final
+{
+public:
+
+    constexpr static int BlocksPerChunk = 256;
+    constexpr static int MaxChunks = 64;
+
+    SlabPool() = default;
+
+    ~SlabPool()
+    {
+        for (auto& chunk : chunks)
+            delete[] chunk.load();
+    }
+
+    /**
+     * Make sure the pool holds at least the given number of blocks.
+     * This is called on patch load to presize the pool.
+     */
+    void reserve(int numBlocks)
+    {
+        while (numChunks.load() * BlocksPerChunk < numBlocks && addChunk()) {}
+    }
+
+    /// Allocate a block, falls back to the system allocator when exhausted.
+    void* allocate()
+    {
+        if (auto* block{ pop() })
+            return block;
+
+        if (addChunk()) {
+            if (auto* block{ pop() })
+                return block;
+        }
+
+        return ::operator new(BlockSize);
+    }
+
+    /// Return a block to the pool. This is lock-free.
+    void deallocate(void* ptr) noexcept
+    {
+        const int index{ indexOf(ptr) };
+
+        if (index < 0) {
+            ::operator delete(ptr);
+            return;
+        }
+
+        push((uint32_t)index);
+    }
+
+    int getNumBlocks() const noexcept { return numChunks.load() * BlocksPerChunk; }
+
+private:
+
+    struct Block
+    {
+        alignas(std::max_align_t) unsigned char data[BlockSize];
+        std::atomic<uint32_t> next;
+    };
+
+    constexpr static uint32_t Empty = 0xFFFFFFFF;
+
+    // Head holds the block index and an ABA tag
+    static uint64_t makeHead(uint32_t index, uint32_t tag) noexcept { return ((uint64_t)tag << 32) | index; }
+    static uint32_t headIndex(uint64_t head) noexcept { return (uint32_t)(head & 0xFFFFFFFF); }
+    static uint32_t headTag(uint64_t head) noexcept { return (uint32_t)(head >> 32); }
+
+    Block& blockAt(uint32_t index) const noexcept
+    {
+        return chunks[index / BlocksPerChunk].load()[index % BlocksPerChunk];
+    }
+
+    int indexOf(void* ptr) const noexcept
+    {
+        const int n{ numChunks.load() };
+
+        for (int i = 0; i < n; ++i) {
+            auto* chunk{ chunks[(size_t)i].load() };
+            auto* p{ static_cast<Block*>(ptr) };
+
+            if (p >= chunk && p < chunk + BlocksPerChunk)
+                return i * BlocksPerChunk + int(p - chunk);
+        }
+
+        return -1;
+    }
+
+    bool addChunk()
+    {
+        const SpinLock::ScopedLockType lock(growLock);
+        const int n{ numChunks.load() };
+
+        if (n == MaxChunks)
+            return false;
+
+        auto* chunk{ new Block[BlocksPerChunk] };
+        chunks[(size_t)n] = chunk;
+        numChunks = n + 1;
+
+        for (int i = 0; i < BlocksPerChunk; ++i)
+            push(uint32_t(n * BlocksPerChunk + i));
+
+        return true;
+    }
+
+    void* pop() noexcept
+    {
+        auto head{ freeHead.load() };
+
+        while (headIndex(head) != Empty) {
+            const auto index{ headIndex(head) };
+            const auto next{ blockAt(index).next.load() };
+
+            if (freeHead.compare_exchange_weak(head, makeHead(next, headTag(head) + 1)))
+                return blockAt(index).data;
+        }
+
+        return nullptr;
+    }
+
+    void push(uint32_t index) noexcept
+    {
+        auto head{ freeHead.load() };
+
+        do {
+            blockAt(index).next.store(headIndex(head));
+        } while (!freeHead.compare_exchange_weak(head, makeHead(index, headTag(head) + 1)));
+    }
+
+    std::array<std::atomic<Block*>, MaxChunks> chunks{};
+    std::atomic<int> numChunks{ 0 };
+    std::atomic<uint64_t> freeHead{ makeHead(Empty, 0) };
+    SpinLock growLock;
+};
+
+/**
+ * Standard allocator drawing single objects from a SlabPool,
+ * e.g. for std::allocate_shared().
+ */
+template <class T, size_t BlockSize>
+class SlabAllocator final
+{
+public:
+    using value_type = T;
+
+    template <class U>
+    struct rebind
+    {
+        using other = SlabAllocator<U, BlockSize>;
+    };
+
+    explicit SlabAllocator(SlabPool<BlockSize>& p) noexcept
+        : pool{ &p }
+    {}
+
+    template <class U>
+    SlabAllocator(const SlabAllocator<U, BlockSize>& other) noexcept
+        : pool{ other.getPool() }
+    {}
+
+    T* allocate(size_t n)
+    {
+        if (n == 1 && sizeof(T) <= BlockSize && alignof(T) <= alignof(std::max_align_t))
+            return static_cast<T*>(pool->allocate());
+
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept
+    {
+        if (n == 1 && sizeof(T) <= BlockSize && alignof(T) <= alignof(std::max_align_t))
+            pool->deallocate(ptr);
+        else
+            ::operator delete(ptr);
+    }
+
+    SlabPool<BlockSize>* getPool() const noexcept { return pool; }
+
+    template <class U>
+    bool operator==(const SlabAllocator<U, BlockSize>& other) const noexcept { return pool == other.getPool(); }
+
+    template <class U>
+    bool operator!=(const SlabAllocator<U, BlockSize>& other) const noexcept { return pool != other.getPool(); }
+
+private:
+    SlabPool<BlockSize>* pool;
+};
@@ -0,0 +1,172 @@
+#include "ThreadConfig.h"
+
+#if JUCE_LINUX
+ #include <pthread.h>
+ #include <sched.h>
+#elif JUCE_WINDOWS
+ #include <windows.h>
+#elif JUCE_MAC
+ #include <mach/mach.h>
+ #include <mach/mach_time.h>
+ #include <mach/thread_policy.h>
+#endif
+
+std::atomic<uint64> ThreadConfig::audioCoresMask{ 0 };
+
+void ThreadConfig::Stats::addWakeup(double latency_ms, double deadline_ms) noexcept
+{
+    ++numWakeups;
+
+    if (latency_ms > deadline_ms)
+        ++numMissedDeadlines;
+
+    if (latency_ms > maxLatency_ms.load(std::memory_order_relaxed))
+        maxLatency_ms.store((float)latency_ms, std::memory_order_relaxed);
+}
+
+void ThreadConfig::Stats::reset() noexcept
+{
+    numWakeups = 0;
+    numMissedDeadlines = 0;
+    maxLatency_ms = 0.0f;
+}
+
+String ThreadConfig::Stats::toString() const
+{
+    return String(numWakeups.load()) + " wakeups, "
+        + String(numMissedDeadlines.load()) + " missed deadlines, max latency "
+        + String(maxLatency_ms.load(), 2) + " ms";
+}
+
+void ThreadConfig::noteAudioThreadCore() noexcept
+{
+    int cpu{ -1 };
+
+#if JUCE_LINUX
+    cpu = sched_getcpu();
+#elif JUCE_WINDOWS
+    cpu = (int)GetCurrentProcessorNumber();
+#endif
+
+    if (cpu < 0 || cpu >= 64)
+        return;
+
+    const auto bit{ (uint64)1 << cpu };
+
+    if ((audioCoresMask.load(std::memory_order_relaxed) & bit) == 0)
+        audioCoresMask.fetch_or(bit, std::memory_order_relaxed);
+}
+
+String ThreadConfig::applyToCurrentThread(const Policy& policy)
+{
+    StringArray applied;
+    const int numCores{ jmin(64, SystemStats::getNumCpus()) };
+
+    // Cores available to the thread
+    uint64 mask{ numCores >= 64 ? ~(uint64)0 : (((uint64)1 << numCores) - 1) };
+    bool allCoresUsed{ false };
+
+    if (policy.avoidAudioCores) {
+        const auto audioCores{ getAudioCoresMask() };
+
+        // Keep at least one core available
+        if ((mask & ~audioCores) != 0)
+            mask &= ~audioCores;
+        else
+            allCoresUsed = true;
+    }
+
+    const String affinity{ allCoresUsed ? "all cores (audio threads seen on all of them)"
+                                        : "affinity 0x" + String::toHexString((int64)mask) };
+
+#if JUCE_LINUX
+    if (policy.realtime) {
+        sched_param param{};
+        param.sched_priority = jlimit(sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO), policy.priority);
+
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+            applied.add("SCHED_FIFO " + String(param.sched_priority));
+        else
+            applied.add("SCHED_OTHER (SCHED_FIFO not permitted)");
+    } else {
+        // Undo a realtime policy applied previously
+        sched_param param{};
+
+        if (pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) == 0)
+            applied.add("SCHED_OTHER");
+        else
+            applied.add("scheduling policy not restored");
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+
+    for (int i = 0; i < numCores; ++i) {
+        if ((mask & ((uint64)1 << i)) != 0)
+            CPU_SET(i, &cpus);
+    }
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0)
+        applied.add(affinity);
+    else
+        applied.add("affinity not set");
+
+#elif JUCE_WINDOWS
+    if (policy.realtime) {
+        if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+            applied.add("THREAD_PRIORITY_TIME_CRITICAL");
+        else
+            applied.add("normal priority (time-critical not permitted)");
+    } else {
+        if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL))
+            applied.add("THREAD_PRIORITY_NORMAL");
+        else
+            applied.add("priority not restored");
+    }
+
+    if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) != 0)
+        applied.add(affinity);
+    else
+        applied.add("affinity not set");
+
+#elif JUCE_MAC
+    // macOS has no affinity control, a time-constraint policy is the closest
+    // to a realtime thread there.
+    if (policy.realtime) {
+        mach_timebase_info_data_t timebase{};
+        mach_timebase_info(&timebase);
+
+        const auto msToAbs = [&timebase](double ms) {
+            return (uint32_t)(ms * 1.0e6 * timebase.denom / timebase.numer);
+        };
+
+        thread_time_constraint_policy_data_t tc{};
+        tc.period = msToAbs(10.0);
+        tc.computation = msToAbs(2.0);
+        tc.constraint = msToAbs(5.0);
+        tc.preemptible = 1;
+
+        if (thread_policy_set(mach_thread_self(), THREAD_TIME_CONSTRAINT_POLICY,
+                              (thread_policy_t)&tc, THREAD_TIME_CONSTRAINT_POLICY_COUNT) == KERN_SUCCESS)
+            applied.add("time-constraint policy");
+        else
+            applied.add("default policy (time-constraint not permitted)");
+    } else {
+        thread_standard_policy_data_t standard{};
+
+        if (thread_policy_set(mach_thread_self(), THREAD_STANDARD_POLICY,
+                              (thread_policy_t)&standard, THREAD_STANDARD_POLICY_COUNT) == KERN_SUCCESS)
+            applied.add("standard policy");
+        else
+            applied.add("policy not restored");
+    }
+
+    ignoreUnused(mask, affinity);
+    applied.add("affinity not supported");
+#else
+    ignoreUnused(mask, affinity);
+    applied.add("default policy");
+#endif
+
+    return applied.joinIntoString(", ");
+}
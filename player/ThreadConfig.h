@@ -0,0 +1,67 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+
+/**
+ * Scheduling configuration of the player threads.
+ *
+ * Threads can be given a realtime policy (SCHED_FIFO, time-constraint or
+ * time-critical priority depending on the platform) where permitted, and
+ * pinned to the cores not used by the host audio thread. The realtime policy
+ * is opt-in: a runaway realtime thread can starve the rest of the system,
+ * host audio thread included. Each configured thread keeps wake-up latency
+ * statistics so that late deliveries can be diagnosed.
+ */
+class ThreadConfig final
+{
+public:
+
+    struct Policy
+    {
+        bool realtime{ false };
+        int priority{ 10 };             // 1..99, SCHED_FIFO priority on Linux
+        bool avoidAudioCores{ true };   // Keep off the host audio thread cores
+    };
+
+    /**
+     * Wake-up statistics of a thread.
+     */
+    struct Stats
+    {
+        std::atomic<int64> numWakeups{ 0 };
+        std::atomic<int64> numMissedDeadlines{ 0 };
+        std::atomic<float> maxLatency_ms{ 0.0f };
+
+        /// Record a wake-up, latency is from the signal to the thread running.
+        void addWakeup(double latency_ms, double deadline_ms) noexcept;
+
+        void reset() noexcept;
+
+        String toString() const;
+    };
+
+    /**
+     * Apply the policy to the calling thread.
+     * A non-realtime policy restores the default scheduling of the thread.
+     *
+     * If the audio threads have been seen on all the cores, the thread
+     * is allowed on all of them and the description says so.
+     *
+     * @return Description of the policy actually applied.
+     */
+    static String applyToCurrentThread(const Policy& policy);
+
+    /**
+     * Record the core the calling (host audio) thread runs on.
+     * This is lock-free and cheap enough to be called on each block.
+     */
+    static void noteAudioThreadCore() noexcept;
+
+    /// Mask of the cores the audio threads have been seen running on, it only grows.
+    static uint64 getAudioCoresMask() noexcept { return audioCoresMask.load(std::memory_order_relaxed); }
+
+private:
+
+    static std::atomic<uint64> audioCoresMask;
+};
@@ -0,0 +1,32 @@
+#include "TriggerResources.h"
+#include <algorithm>
+
+// Once the keeper is the only owner nobody can get a new reference,
+// so the object can be destroyed safely.
+template <class T>
+static void collectUnused(std::vector<T>& objects)
+{
+    objects.erase(std::remove_if(objects.begin(), objects.end(),
+        [](const auto& object) { return object.use_count() == 1; }), objects.end());
+}
+
+void TriggerResources::keep(const Trigger& trigger)
+{
+    if (trigger.fxChain != nullptr)
+        fxChains.push_back(trigger.fxChain);
+
+    if (trigger.modulator != nullptr)
+        modulators.push_back(trigger.modulator);
+}
+
+void TriggerResources::collect()
+{
+    collectUnused(fxChains);
+    collectUnused(modulators);
+}
+
+void TriggerResources::clear()
+{
+    fxChains.clear();
+    modulators.clear();
+}
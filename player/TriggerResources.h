@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "engine.h"
+#include <memory>
+#include <vector>
+
+/**
+ * Keeps the heap objects of the voice triggers (effects chain, modulator)
+ * alive until the engine is done with them.
+ *
+ * The engine voices hold the trigger objects by shared pointer and drop
+ * them on the audio thread when they end. As long as the keeper holds
+ * another reference, the last one is always released here, on the script
+ * thread, so that neither the objects nor their strings and maps are
+ * freed on the audio thread.
+ *
+ * @note This must only be called with the script lock held.
+ */
+class TriggerResources final
+{
+public:
+
+    using Trigger = tonewheel::Engine::Trigger;
+
+    TriggerResources() = default;
+
+    /// Hold the trigger objects, if any.
+    void keep(const Trigger& trigger);
+
+    /// Destroy the objects no longer referenced by the engine.
+    void collect();
+
+    /**
+     * Destroy all the objects.
+     *
+     * @note This must only be called when the engine holds no voices.
+     */
+    void clear();
+
+private:
+
+    std::vector<decltype(Trigger::fxChain)> fxChains;
+    std::vector<decltype(Trigger::modulator)> modulators;
+};
@@ -0,0 +1,409 @@
+#include "VoiceBudget.h"
+#include "SamplePrefetcher.h"
+
+std::atomic<int> VoiceBudget::numInstances{ 0 };
+std::atomic<int> VoiceBudget::numActiveInstances{ 0 };
+std::atomic<int> VoiceBudget::stealRequests{ 0 };
+std::atomic<uint32> VoiceBudget::nextInstanceTag{ 1 };
+
+// The engine voice pool is shared by all the instances
+static auto& getVoicePool()
+{
+    return tonewheel::GlobalEngine::getInstance()->getVoicePool();
+}
+
+// Owner tag of each engine voice, set by the instance which started it last
+static auto& getVoiceOwners()
+{
+    static std::vector<std::atomic<uint64>> owners(getVoicePool().getNumVoices());
+    return owners;
+}
+
+VoiceBudget::VoiceBudget(tonewheel::Engine& eng)
+    : engine{ eng }
+    , instanceTag{ nextInstanceTag++ }
+{
+    scriptFreeList.reserve(NumHandles);
+    audioFreeList.reserve(NumHandles);
+    reset();
+
+    // Allocated here rather than on the audio thread
+    getVoiceOwners();
+
+    ++numInstances;
+}
+
+VoiceBudget::~VoiceBudget()
+{
+    if (active)
+        --numActiveInstances;
+
+    --numInstances;
+}
+
+int VoiceBudget::getBudget() const noexcept
+{
+    const int poolSize{ (int)getVoicePool().getNumVoices() };
+    return jmax(1, poolSize / jmax(1, getNumActiveInstances()));
+}
+
+int VoiceBudget::postTrigger(Trigger& trigger)
+{
+    // Check for room first, so that a reserved slot is never lost
+    if ((writeTail + 1) % QueueSize == commandsHead.load(std::memory_order_acquire))
+        return NoVoice;
+
+    int slot{};
+
+    while (recycleQueue.receive(slot))
+        scriptFreeList.push_back(slot);
+
+    if (scriptFreeList.empty())
+        return NoVoice;
+
+    slot = scriptFreeList.back();
+    scriptFreeList.pop_back();
+
+    scriptGeneration = (scriptGeneration + 1) % MaxGeneration;
+    const int voiceId{ slot + NumSlots * scriptGeneration };
+
+    // Whatever is left from the previous trigger gets destroyed here,
+    // on the script thread.
+    scriptTriggers[(size_t)slot] = std::move(trigger);
+
+    push({ CommandType::Trigger, voiceId, 0.0f });
+
+    return voiceId;
+}
+
+bool VoiceBudget::reserve(int numTriggers)
+{
+    const int room{ (commandsHead.load(std::memory_order_acquire) - writeTail - 1 + QueueSize) % QueueSize };
+
+    if (numTriggers > room)
+        return false;
+
+    int slot{};
+
+    while (recycleQueue.receive(slot))
+        scriptFreeList.push_back(slot);
+
+    return numTriggers <= (int)scriptFreeList.size();
+}
+
+bool VoiceBudget::postRelease(int voiceId, float releaseTime)
+{
+    if (voiceId < 0)
+        return true;
+
+    return push({ CommandType::Release, voiceId, releaseTime });
+}
+
+void VoiceBudget::endBatch() noexcept
+{
+    jassert(batchDepth > 0);
+
+    if (--batchDepth == 0)
+        commandsTail.store(writeTail, std::memory_order_release);
+}
+
+void VoiceBudget::reset()
+{
+    commandsHead = 0;
+    commandsTail = 0;
+    writeTail = 0;
+    batchDepth = 0;
+
+    int slot{};
+
+    while (recycleQueue.receive(slot)) {}
+
+    for (auto& trigger : scriptTriggers)
+        trigger = {};
+
+    scriptFreeList.clear();
+
+    for (int i = NumHandles - 1; i >= 0; --i)
+        scriptFreeList.push_back(i);
+
+    audioFreeList.clear();
+
+    for (int i = NumSlots - 1; i >= NumHandles; --i)
+        audioFreeList.push_back(i);
+
+    voices.fill({});
+    heldVoices = {};
+    releasedVoices = {};
+    busVoices.fill(0);
+
+    scriptGeneration = 0;
+    audioGeneration = 0;
+
+    updateNumVoices();
+}
+
+void VoiceBudget::beginBlock()
+{
+    prune(heldVoices);
+    prune(releasedVoices);
+
+    auto& pool{ getVoicePool() };
+
+    if ((int)pool.getNumActiveVoices() < (int)pool.getNumVoices()) {
+        // There is room again, the pending requests are void
+        stealRequests.store(0, std::memory_order_relaxed);
+    } else {
+        const int budget{ getBudget() };
+        int requests{ stealRequests.load(std::memory_order_relaxed) };
+
+        while (requests > 0 && heldVoices.size > budget) {
+            if (stealRequests.compare_exchange_weak(requests, requests - 1))
+                stealOldest();
+        }
+    }
+
+    updateNumVoices();
+}
+
+void VoiceBudget::processCommands()
+{
+    const int tail{ commandsTail.load(std::memory_order_acquire) };
+    int head{ commandsHead.load(std::memory_order_relaxed) };
+
+    while (head != tail) {
+        const auto command{ commands[(size_t)head] };
+
+        if (command.type == CommandType::Trigger) {
+            const int slot{ slotOf(command.voiceId) };
+            start(slot, command.voiceId, scriptTriggers[(size_t)slot]);
+        } else {
+            releaseVoice(command.voiceId, command.releaseTime);
+        }
+
+        head = (head + 1) % QueueSize;
+    }
+
+    commandsHead.store(head, std::memory_order_release);
+}
+
+int VoiceBudget::triggerVoice(Trigger& trigger)
+{
+    if (audioFreeList.empty())
+        return NoVoice;
+
+    const int slot{ audioFreeList.back() };
+    audioFreeList.pop_back();
+
+    audioGeneration = (audioGeneration + 1) % MaxGeneration;
+
+    return start(slot, slot + NumSlots * audioGeneration, trigger);
+}
+
+void VoiceBudget::releaseVoice(int voiceId, float releaseTime)
+{
+    if (voiceId < 0)
+        return;
+
+    const int slot{ slotOf(voiceId) };
+
+    if (const auto& voice{ voices[(size_t)slot] }; voice.voiceId == voiceId && !voice.released)
+        stop(slot, releaseTime);
+}
+
+uint32 VoiceBudget::getBusesWithVoices() const noexcept
+{
+    uint32 mask{ 0 };
+
+    for (int bus = 0; bus < tonewheel::NUM_BUSES; ++bus) {
+        if (busVoices[(size_t)bus] > 0)
+            mask |= 1u << bus;
+    }
+
+    return mask;
+}
+
+bool VoiceBudget::push(const Command& command)
+{
+    const int next{ (writeTail + 1) % QueueSize };
+
+    if (next == commandsHead.load(std::memory_order_acquire))
+        return false;
+
+    commands[(size_t)writeTail] = command;
+    writeTail = next;
+
+    // Batched commands are published all at once by endBatch()
+    if (batchDepth == 0)
+        commandsTail.store(writeTail, std::memory_order_release);
+
+    return true;
+}
+
+int VoiceBudget::start(int slot, int voiceId, Trigger& trigger)
+{
+    const int bus{ (int)trigger.busNumber };
+
+    // Voices on a bus which is not rendered would never end
+    if (bus < 0 || bus >= tonewheel::NUM_BUSES || (busesMask.load(std::memory_order_relaxed) & (1u << bus)) == 0) {
+        freeSlot(slot);
+        return NoVoice;
+    }
+
+    auto& pool{ getVoicePool() };
+
+    // Make room when the pool is full: from this instance if over budget,
+    // otherwise from the instances over budget on their next block.
+    if ((int)pool.getNumActiveVoices() >= (int)pool.getNumVoices()) {
+        if (heldVoices.size >= getBudget())
+            stealOldest();
+        else
+            ++stealRequests;
+    }
+
+    if (prefetcher != nullptr)
+        prefetcher->noteTrigger((int)trigger.sampleId);
+
+    const int engineVoiceId{ engine.triggerVoice(trigger) };
+
+    if (engineVoiceId < 0) {
+        freeSlot(slot);
+        return NoVoice;
+    }
+
+    auto& owners{ getVoiceOwners() };
+
+    if (engineVoiceId < (int)owners.size())
+        owners[(size_t)engineVoiceId].store(ownerTagOf(voiceId), std::memory_order_release);
+
+    auto& voice{ voices[(size_t)slot] };
+    voice.voiceId = voiceId;
+    voice.engineVoiceId = engineVoiceId;
+    voice.bus = bus;
+    append(heldVoices, slot);
+    ++busVoices[(size_t)bus];
+
+    updateNumVoices();
+
+    return voiceId;
+}
+
+void VoiceBudget::stop(int slot, float releaseTime)
+{
+    auto& voice{ voices[(size_t)slot] };
+
+    // Otherwise the engine voice has ended and now belongs to someone else,
+    // the slot is pruned on the next block.
+    if (ownsEngineVoice(slot)) {
+        if (releaseTime >= 0.0f)
+            engine.releaseVoice(voice.engineVoiceId, releaseTime);
+        else
+            engine.releaseVoice(voice.engineVoiceId);
+    }
+
+    // Still accounted while sounding, until pruned
+    remove(heldVoices, slot);
+    voice.released = true;
+    append(releasedVoices, slot);
+}
+
+void VoiceBudget::freeSlot(int slot)
+{
+    voices[(size_t)slot] = {};
+
+    if (slot < NumHandles)
+        recycleQueue.send(slot);
+    else
+        audioFreeList.push_back(slot);
+}
+
+bool VoiceBudget::stealOldest()
+{
+    // Voices whose engine voice has been reused are gone already, stealing them frees nothing
+    while (heldVoices.head >= 0 && !ownsEngineVoice(heldVoices.head))
+        forget(heldVoices, heldVoices.head);
+
+    const int oldest{ heldVoices.head };
+
+    if (oldest < 0)
+        return false;
+
+    stop(oldest, -1.0f);
+
+    return true;
+}
+
+void VoiceBudget::append(List& list, int slot) noexcept
+{
+    auto& voice{ voices[(size_t)slot] };
+    voice.prev = list.tail;
+    voice.next = -1;
+
+    if (list.tail >= 0)
+        voices[(size_t)list.tail].next = slot;
+    else
+        list.head = slot;
+
+    list.tail = slot;
+    ++list.size;
+}
+
+void VoiceBudget::remove(List& list, int slot) noexcept
+{
+    auto& voice{ voices[(size_t)slot] };
+
+    if (voice.prev >= 0)
+        voices[(size_t)voice.prev].next = voice.next;
+    else
+        list.head = voice.next;
+
+    if (voice.next >= 0)
+        voices[(size_t)voice.next].prev = voice.prev;
+    else
+        list.tail = voice.prev;
+
+    voice.prev = -1;
+    voice.next = -1;
+    --list.size;
+}
+
+bool VoiceBudget::ownsEngineVoice(int slot) const noexcept
+{
+    const auto& voice{ voices[(size_t)slot] };
+    const auto& owners{ getVoiceOwners() };
+
+    return voice.engineVoiceId >= 0 && voice.engineVoiceId < (int)owners.size()
+        && owners[(size_t)voice.engineVoiceId].load(std::memory_order_acquire) == ownerTagOf(voice.voiceId);
+}
+
+void VoiceBudget::forget(List& list, int slot)
+{
+    --busVoices[(size_t)voices[(size_t)slot].bus];
+    remove(list, slot);
+    freeSlot(slot);
+}
+
+void VoiceBudget::prune(List& list)
+{
+    auto& pool{ getVoicePool() };
+
+    for (int slot{ list.head }; slot >= 0;) {
+        const auto& voice{ voices[(size_t)slot] };
+        const int next{ voice.next };
+
+        if (!ownsEngineVoice(slot) || !pool.isVoiceActive(voice.engineVoiceId))
+            forget(list, slot);
+
+        slot = next;
+    }
+}
+
+void VoiceBudget::updateNumVoices() noexcept
+{
+    const int n{ heldVoices.size + releasedVoices.size };
+    numVoices.store(n, std::memory_order_relaxed);
+
+    if (active != (n > 0)) {
+        active = n > 0;
+        numActiveInstances += active ? 1 : -1;
+    }
+}
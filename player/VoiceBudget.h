@@ -0,0 +1,248 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "engine.h"
+#include "core/ring_buffer.h"
+#include <array>
+#include <atomic>
+#include <limits>
+#include <vector>
+
+class SamplePrefetcher;
+
+/**
+ * Per-instance voices accounting.
+ *
+ * The engine voice pool is shared by all the plugin instances of the
+ * process. Each instance triggers and releases its voices through its
+ * budget, which tracks the voices held by the instance until they end.
+ * An instance may use the whole pool while the others are idle. Once the
+ * pool is full, the instances over their fair share (the pool split
+ * between the instances holding voices) release their oldest voices,
+ * so one busy instance cannot starve the others.
+ *
+ * The engine events queue has a single producer: the engine voices are
+ * only ever triggered and released on the audio thread. The script posts
+ * its triggers and releases to the budget commands queue, which the audio
+ * thread drains right before processing the engine events.
+ *
+ * Voice IDs handed out by the budget are handles (slot + generation),
+ * so that the script gets an ID synchronously, before the engine voice
+ * exists. Handles of voices which are gone are ignored.
+ *
+ * Voices are kept in trigger order, so that the oldest one is stolen
+ * in constant time. Voices that end on their own (one-shots) are pruned
+ * on each block.
+ *
+ * Engine voice IDs are pool indices, reused by any instance once a voice
+ * ends. Each engine voice is tagged with the instance and the handle which
+ * started it last, and a voice is only released by the instance whose tag
+ * it still holds, so that an instance never releases another instance voice.
+ */
+class VoiceBudget final
+{
+public:
+
+    /// Voice handles available to each of the script and the audio thread.
+    constexpr static int NumHandles = 1024;
+
+    /// Script commands queued between two audio blocks.
+    constexpr static int QueueSize = 1024;
+
+    constexpr static int NoVoice = -1;
+
+    using Trigger = tonewheel::Engine::Trigger;
+
+    VoiceBudget(tonewheel::Engine& eng);
+    ~VoiceBudget();
+
+    /**
+     * Queue a voice trigger from the script.
+     *
+     * The trigger is moved into the queue and the voice is started by
+     * the audio thread on the next processCommands() call.
+     *
+     * @note This must only be called with the script lock held,
+     *       so that there is a single producer of the queue.
+     *
+     * @return Voice ID, or NoVoice if the queue is full.
+     */
+    int postTrigger(Trigger& trigger);
+
+    /**
+     * Queue a voice release from the script, see postTrigger().
+     * Negative release time - use the voice envelope.
+     *
+     * @return false if the queue is full.
+     */
+    bool postRelease(int voiceId, float releaseTime = -1.0f);
+
+    /**
+     * Check that the given number of triggers can be posted: the queue has
+     * room for as many commands and as many voice handles are free.
+     * Since the script is the only producer, the triggers posted right after
+     * a successful check cannot fail.
+     *
+     * @note This must only be called with the script lock held.
+     */
+    bool reserve(int numTriggers);
+
+    /**
+     * Start a batch of script commands.
+     *
+     * The commands posted until endBatch() are published to the audio
+     * thread at once, so that they are all executed on the same sample
+     * frame. The audio thread is never held back by a batch in progress.
+     */
+    void beginBatch() noexcept { ++batchDepth; }
+
+    /// Publish the commands of the batch.
+    void endBatch() noexcept;
+
+    /**
+     * Engine buses the voices can be triggered on, the buses outside
+     * of the mask are not rendered by the audio thread.
+     */
+    void setBusesMask(uint32 mask) noexcept { busesMask.store(mask, std::memory_order_relaxed); }
+
+    /// Prefetcher accounting the triggered samples, optional.
+    void setPrefetcher(SamplePrefetcher* p) noexcept { prefetcher = p; }
+
+    /// Number of voices held by this instance, including the released ones still sounding.
+    int getNumVoices() const noexcept { return numVoices.load(std::memory_order_relaxed); }
+
+    /// Current fair share of voices for this instance.
+    int getBudget() const noexcept;
+
+    /// Number of plugin instances in the process.
+    static int getNumInstances() noexcept { return numInstances.load(std::memory_order_relaxed); }
+
+    /// Number of plugin instances currently holding voices.
+    static int getNumActiveInstances() noexcept { return numActiveInstances.load(std::memory_order_relaxed); }
+
+    /**
+     * Forget all the tracked voices and drop the queued commands.
+     *
+     * @note This must only be called when neither the script
+     *       nor the audio threads are running.
+     */
+    void reset();
+
+    // Audio thread interface
+
+    /**
+     * Forget the voices which have ended and give voices up
+     * to the other instances if requested.
+     */
+    void beginBlock();
+
+    /// Execute the commands queued by the script.
+    void processCommands();
+
+    /**
+     * Trigger a voice, stealing the oldest instance voice if the pool
+     * is full and the instance is over its budget.
+     *
+     * @return Voice ID, or NoVoice if the voice could not be started.
+     */
+    int triggerVoice(Trigger& trigger);
+
+    /// Release a voice, negative release time - use the voice envelope.
+    void releaseVoice(int voiceId, float releaseTime = -1.0f);
+
+    /// Mask of the buses which have voices sounding.
+    uint32 getBusesWithVoices() const noexcept;
+
+private:
+
+    constexpr static int NumSlots = NumHandles * 2;     // Script slots first
+    constexpr static int MaxGeneration = std::numeric_limits<int>::max() / NumSlots;
+
+    enum class CommandType
+    {
+        Trigger,
+        Release
+    };
+
+    struct Command
+    {
+        CommandType type;
+        int voiceId;
+        float releaseTime;
+    };
+
+    // Audio thread only
+    struct Voice
+    {
+        int voiceId{ NoVoice };         // Handle the slot is allocated to
+        int engineVoiceId{ NoVoice };
+        int bus{ 0 };
+        int prev{ -1 };
+        int next{ -1 };
+        bool released{ false };
+    };
+
+    // Voices in trigger order
+    struct List
+    {
+        int head{ -1 };
+        int tail{ -1 };
+        int size{ 0 };
+    };
+
+    static int slotOf(int voiceId) noexcept { return voiceId % NumSlots; }
+
+    uint64 ownerTagOf(int voiceId) const noexcept { return (uint64(instanceTag) << 32) | uint32(voiceId); }
+    bool ownsEngineVoice(int slot) const noexcept;
+
+    void append(List& list, int slot) noexcept;
+    void remove(List& list, int slot) noexcept;
+    void forget(List& list, int slot);
+    void prune(List& list);
+    void updateNumVoices() noexcept;
+
+    bool push(const Command& command);
+
+    int start(int slot, int voiceId, Trigger& trigger);
+    void stop(int slot, float releaseTime);
+    void freeSlot(int slot);
+    bool stealOldest();
+
+    tonewheel::Engine& engine;
+    SamplePrefetcher* prefetcher{ nullptr };
+    const uint32 instanceTag;
+
+    // Commands queue, written by the script and read by the audio thread
+    std::array<Command, QueueSize> commands{};
+    std::atomic<int> commandsHead{ 0 };
+    std::atomic<int> commandsTail{ 0 };
+
+    // Script thread only
+    int writeTail{ 0 };
+    int batchDepth{ 0 };
+    std::array<Trigger, NumHandles> scriptTriggers;
+    std::vector<int> scriptFreeList;
+    int scriptGeneration{ 0 };
+
+    tonewheel::core::RingBuffer<int, NumHandles * 2> recycleQueue;
+
+    // Audio thread only
+    std::array<Voice, NumSlots> voices;
+    std::vector<int> audioFreeList;
+    int audioGeneration{ 0 };
+    List heldVoices;
+    List releasedVoices;
+    std::array<int, tonewheel::NUM_BUSES> busVoices{};
+    bool active{ false };
+
+    std::atomic<uint32> busesMask{ 0xFFFFFFFF };
+
+    std::atomic<int> numVoices{ 0 };
+
+    static std::atomic<int> numInstances;
+    static std::atomic<int> numActiveInstances;
+    static std::atomic<uint32> nextInstanceTag;
+
+    // Voices requested by the instances under budget when the pool is full
+    static std::atomic<int> stealRequests;
+};
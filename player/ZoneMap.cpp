@@ -0,0 +1,253 @@
+#include "ZoneMap.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+
+void ZoneMap::Zone::setTemplate(const Trigger& trigger)
+{
+    sampleId = trigger.sampleId;
+    busNumber = trigger.busNumber;
+    rootKey = trigger.rootKey;
+    offset = trigger.offset;
+    gain = trigger.gain;
+    tune = trigger.tune;
+    loopBegin = trigger.loopBegin;
+    loopEnd = trigger.loopEnd;
+    loopXfade = trigger.loopXfade;
+    envelope = trigger.envelope;
+}
+
+void ZoneMap::Zone::applyTemplate(Trigger& trigger) const
+{
+    trigger.sampleId = sampleId;
+    trigger.busNumber = busNumber;
+    trigger.rootKey = rootKey;
+    trigger.offset = offset;
+    trigger.gain = gain;
+    trigger.tune = tune;
+    trigger.loopBegin = loopBegin;
+    trigger.loopEnd = loopEnd;
+    trigger.loopXfade = loopXfade;
+    trigger.envelope = envelope;
+}
+
+//==============================================================================
+
+ZoneMap::ZoneMap(VoiceBudget& budget)
+    : voiceBudget{ budget }
+{
+    reset();
+}
+
+ZoneMap::~ZoneMap() = default;
+
+bool ZoneMap::setZones(const std::vector<Zone>& zones)
+{
+    if (zones.empty()) {
+        table.publish(nullptr);
+        return true;
+    }
+
+    auto newTable{ compile(zones) };
+
+    if (newTable == nullptr)
+        return false;
+
+    table.publish(std::move(newTable));
+    return true;
+}
+
+void ZoneMap::reset()
+{
+    table.reset();
+
+    for (auto& held : heldKeys) {
+        held.numVoices = 0;
+        held.active = false;
+        held.keyDown = false;
+    }
+
+    sustain.fill(false);
+}
+
+bool ZoneMap::process(const MidiMessage& msg)
+{
+    const int channel{ msg.getChannel() - 1 };
+
+    if (channel < 0 || channel >= NumChannels)
+        return false;
+
+    if (msg.isNoteOn())
+        return noteOn(channel, msg.getNoteNumber(), msg.getFloatVelocity(), (int)msg.getVelocity());
+
+    if (msg.isNoteOff())
+        return noteOff(channel, msg.getNoteNumber());
+
+    // Sustain pedal is tracked, the message then goes on to the controller map,
+    // which passes it on to the script unless CC 64 is bound to a parameter
+    if (msg.isControllerOfType(SustainPedalCC))
+        setSustain(channel, msg.getControllerValue() >= 64);
+
+    return false;
+}
+
+std::unique_ptr<ZoneMap::Table> ZoneMap::compile(const std::vector<Zone>& zones)
+{
+    auto t{ std::make_unique<Table>() };
+    t->zones = zones;
+    t->cells.assign((size_t)NumChannels * NumKeys * NumVelocities, 0);
+
+    // Each cell refers to a list of zones covering it. Lists are shared
+    // between the cells and extended zone by zone.
+    std::vector<std::vector<int>> lists{ {} };
+    std::map<std::pair<int, int>, int> extended{};
+
+    for (int z = 0; z < (int)zones.size(); ++z) {
+        const auto& zone{ zones[(size_t)z] };
+
+        const int chLow{ jlimit(0, NumChannels - 1, zone.channelLow - 1) };
+        const int chHigh{ jlimit(0, NumChannels - 1, zone.channelHigh - 1) };
+        const int keyLow{ jlimit(0, NumKeys - 1, zone.keyLow) };
+        const int keyHigh{ jlimit(0, NumKeys - 1, zone.keyHigh) };
+        const int velLow{ jlimit(1, NumVelocities - 1, zone.velocityLow) };
+        const int velHigh{ jlimit(1, NumVelocities - 1, zone.velocityHigh) };
+
+        for (int ch = chLow; ch <= chHigh; ++ch) {
+            for (int key = keyLow; key <= keyHigh; ++key) {
+                for (int vel = velLow; vel <= velHigh; ++vel) {
+                    auto& cell{ t->cells[cellIndex(ch, key, vel)] };
+                    const auto k{ std::make_pair((int)cell, z) };
+
+                    if (auto it{ extended.find(k) }; it != extended.end()) {
+                        cell = (uint16_t)it->second;
+                        continue;
+                    }
+
+                    if (lists.size() > std::numeric_limits<uint16_t>::max())
+                        return nullptr;
+
+                    auto list{ lists[cell] };
+                    list.push_back(z);
+                    lists.push_back(std::move(list));
+
+                    extended[k] = (int)lists.size() - 1;
+                    cell = (uint16_t)(lists.size() - 1);
+                }
+            }
+        }
+    }
+
+    // Split each zones list into round-robin slots
+    t->groups.reserve(lists.size() - 1);
+
+    for (size_t i = 1; i < lists.size(); ++i) {
+        auto list{ lists[i] };
+
+        std::stable_sort(list.begin(), list.end(), [&zones](int a, int b) {
+            return zones[(size_t)a].roundRobin < zones[(size_t)b].roundRobin;
+        });
+
+        Group group{ (int)t->slots.size(), 0, 0 };
+
+        for (size_t j = 0; j < list.size(); ++j) {
+            if (j == 0 || zones[(size_t)list[j]].roundRobin != zones[(size_t)list[j - 1]].roundRobin) {
+                t->slots.push_back({ (int)t->slotZones.size(), 0 });
+                ++group.numSlots;
+            }
+
+            t->slotZones.push_back(list[j]);
+            ++t->slots.back().count;
+        }
+
+        t->groups.push_back(group);
+    }
+
+    return t;
+}
+
+bool ZoneMap::noteOn(int channel, int key, float velocity, int velocityIndex)
+{
+    if (velocityIndex < 1 || velocityIndex >= NumVelocities)
+        return false;
+
+    bool handled{ false };
+
+    if (const RealtimePublisher<Table>::ScopedAccess t{ table }) {
+        if (const auto cell{ t->cells[cellIndex(channel, key, velocityIndex)] }; cell != 0) {
+            auto& group{ t->groups[(size_t)cell - 1] };
+            const auto& slot{ t->slots[(size_t)(group.firstSlot + group.roundRobinCounter)] };
+            group.roundRobinCounter = (group.roundRobinCounter + 1) % group.numSlots;
+
+            auto& held{ heldKeys[(size_t)(channel * NumKeys + key)] };
+
+            for (int i = 0; i < slot.count; ++i) {
+                const auto& zone{ t->zones[(size_t)t->slotZones[(size_t)(slot.first + i)]] };
+
+                Trigger trigger{};
+                zone.applyTemplate(trigger);
+                trigger.key = key;
+                trigger.gain *= std::pow(velocity, zone.velocityCurve);
+
+                const auto voiceId{ voiceBudget.triggerVoice(trigger) };
+
+                if (!zone.release)
+                    continue;
+
+                if (held.numVoices == MaxVoicesPerKey) {
+                    // Out of tracking slots: release the oldest voice rather than leaving it hanging
+                    voiceBudget.releaseVoice(held.voiceIds[0]);
+                    std::move(held.voiceIds.begin() + 1, held.voiceIds.end(), held.voiceIds.begin());
+                    --held.numVoices;
+                }
+
+                held.voiceIds[(size_t)held.numVoices++] = voiceId;
+            }
+
+            held.active = true;
+            held.keyDown = true;
+            handled = true;
+        }
+    }
+
+    return handled;
+}
+
+bool ZoneMap::noteOff(int channel, int key)
+{
+    auto& held{ heldKeys[(size_t)(channel * NumKeys + key)] };
+
+    if (!held.active)
+        return false;
+
+    held.keyDown = false;
+
+    if (!sustain[(size_t)channel])
+        releaseKey(held);
+
+    return true;
+}
+
+void ZoneMap::setSustain(int channel, bool down)
+{
+    sustain[(size_t)channel] = down;
+
+    if (down)
+        return;
+
+    for (int key = 0; key < NumKeys; ++key) {
+        auto& held{ heldKeys[(size_t)(channel * NumKeys + key)] };
+
+        if (held.active && !held.keyDown)
+            releaseKey(held);
+    }
+}
+
+void ZoneMap::releaseKey(HeldKey& held)
+{
+    for (int i = 0; i < held.numVoices; ++i)
+        voiceBudget.releaseVoice(held.voiceIds[(size_t)i]);
+
+    held.numVoices = 0;
+    held.active = false;
+}
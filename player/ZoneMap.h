@@ -0,0 +1,136 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "engine.h"
+#include "RealtimePublisher.h"
+#include "VoiceBudget.h"
+#include <array>
+#include <memory>
+#include <vector>
+
+/**
+ * Native key/velocity zones map.
+ *
+ * Zones are compiled on the script thread into a dense lookup table
+ * (channel x key x velocity) of zone groups. Each group holds the zones
+ * covering a cell, split into round-robin slots. The table is then published
+ * to the audio thread, where matching note-on/off messages trigger and release
+ * voices directly, without involving the script.
+ */
+class ZoneMap final
+{
+public:
+
+    constexpr static int NumChannels = 16;
+    constexpr static int NumKeys = 128;
+    constexpr static int NumVelocities = 128;
+    constexpr static int MaxVoicesPerKey = 16;
+    constexpr static int SustainPedalCC = 64;
+
+    using Trigger = tonewheel::Engine::Trigger;
+
+    struct Zone
+    {
+        int keyLow{ 0 };
+        int keyHigh{ NumKeys - 1 };
+        int velocityLow{ 1 };
+        int velocityHigh{ NumVelocities - 1 };
+        int channelLow{ 1 };
+        int channelHigh{ NumChannels };
+        int roundRobin{ 0 };
+        bool release{ true };
+        float velocityCurve{ 1.0f };
+
+        // Voice template
+        decltype(Trigger::sampleId) sampleId{};
+        decltype(Trigger::busNumber) busNumber{};
+        decltype(Trigger::rootKey) rootKey{};
+        decltype(Trigger::offset) offset{};
+        decltype(Trigger::gain) gain{};
+        decltype(Trigger::tune) tune{};
+        decltype(Trigger::loopBegin) loopBegin{};
+        decltype(Trigger::loopEnd) loopEnd{};
+        decltype(Trigger::loopXfade) loopXfade{};
+        decltype(Trigger::envelope) envelope{};
+
+        void setTemplate(const Trigger& trigger);
+        void applyTemplate(Trigger& trigger) const;
+    };
+
+    ZoneMap(VoiceBudget& budget);
+    ~ZoneMap();
+
+    /**
+     * Compile and publish the zones.
+     * This must be called on the script thread.
+     *
+     * @return false if the zones cannot be compiled.
+     */
+    bool setZones(const std::vector<Zone>& zones);
+
+    /**
+     * Drop the zones and the voices tracking.
+     *
+     * @note This must only be called when the audio thread is not running.
+     */
+    void reset();
+
+    /**
+     * Handle a MIDI message on the audio thread.
+     *
+     * @return true if the message has been consumed by the map.
+     */
+    bool process(const MidiMessage& msg);
+
+private:
+
+    struct Slot
+    {
+        int first;
+        int count;
+    };
+
+    struct Group
+    {
+        int firstSlot;
+        int numSlots;
+        int roundRobinCounter;
+    };
+
+    struct Table
+    {
+        std::vector<uint16_t> cells;    // Group index + 1, 0 - no zones
+        std::vector<Zone> zones;
+        std::vector<int> slotZones;
+        std::vector<Slot> slots;
+        std::vector<Group> groups;
+    };
+
+    struct HeldKey
+    {
+        std::array<int, MaxVoicesPerKey> voiceIds;
+        int numVoices{ 0 };
+        bool active{ false };
+        bool keyDown{ false };
+    };
+
+    static size_t cellIndex(int channel, int key, int velocity) noexcept
+    {
+        return ((size_t)channel * NumKeys + (size_t)key) * NumVelocities + (size_t)velocity;
+    }
+
+    static std::unique_ptr<Table> compile(const std::vector<Zone>& zones);
+
+    bool noteOn(int channel, int key, float velocity, int velocityIndex);
+    bool noteOff(int channel, int key);
+    void setSustain(int channel, bool down);
+    void releaseKey(HeldKey& held);
+
+    VoiceBudget& voiceBudget;
+
+    RealtimePublisher<Table> table;
+
+    // Audio thread only
+    std::array<HeldKey, NumChannels * NumKeys> heldKeys;
+    std::array<bool, NumChannels> sustain;
+};